@@ -0,0 +1,225 @@
+// Benchmarks for the stream pipeline
+//
+//   xmake build bench && xmake run bench [frames.jsonl] [iterations]
+//
+// Replays captured streaming frames through EventHandler::handle with stdout
+// sent to the null device, then runs microbenchmarks for the pieces of the
+// hot path and compares the output formats. Results go to stderr. The corpus
+// is one frame per line, or a recording made with `what record`.
+#include "event_handler.hpp"
+#include "metrics.hpp"
+#include "alloc_stats.hpp"
+#include "frame_log.hpp"
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using namespace Misskey;
+
+void* operator new(std::size_t size) {
+    Misskey::thread_allocs++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// Point stdout at the null device so output cost is ours, not the terminal's
+void silence_stdout() {
+    std::fflush(stdout);
+#ifdef _WIN32
+    int fd = _open("NUL", _O_WRONLY);
+    _dup2(fd, 1);
+    _close(fd);
+#else
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+#endif
+}
+
+// Run op(i) `iterations` times after a warm-up and print one result line
+template <typename Op>
+void run(const char* name, int iterations, Op&& op) {
+    int warmup = std::min(iterations / 10 + 1, 1000);
+    for (int i = 0; i < warmup; i++) op(i);
+
+    LatencyHistogram hist;
+    uint64_t allocs = alloc_count();
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        op(i);
+        hist.record(std::chrono::steady_clock::now() - t0);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    allocs = alloc_count() - allocs;
+
+    std::fprintf(stderr, "%-26s %12.0f ops/s %10.0f ns/op %8.2f allocs/op  p50 %8.0f ns  p99 %8.0f ns\n",
+                 name, iterations / elapsed, elapsed * 1e9 / iterations,
+                 static_cast<double>(allocs) / iterations,
+                 static_cast<double>(hist.quantile(0.50)), static_cast<double>(hist.quantile(0.99)));
+}
+
+// Frames from a recording (plain or gzip'd) or from a file with one per line
+std::vector<std::string> load_frames(const std::string& path) {
+    std::vector<std::string> frames;
+    char magic[8] = {};
+    {
+        std::ifstream probe(path, std::ios::binary);
+        probe.read(magic, sizeof(magic));
+    }
+    bool gzip = static_cast<unsigned char>(magic[0]) == 0x1f && static_cast<unsigned char>(magic[1]) == 0x8b;
+    if (gzip || std::memcmp(magic, frame_log_magic, sizeof(magic)) == 0) {
+        FrameLogReader reader;
+        if (!reader.open(path)) return frames;
+        std::string_view frame;
+        uint64_t time_us;
+        while (reader.next(frame, time_us)) frames.emplace_back(frame);
+        return frames;
+    }
+
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) frames.push_back(line);
+    }
+    return frames;
+}
+
+int main(int argc, char* argv[]) {
+    std::string corpus_path = argc > 1 ? argv[1] : "bench/frames.jsonl";
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 100000;
+    if (iterations < 1) iterations = 1;
+
+    std::vector<std::string> frames = load_frames(corpus_path);
+    if (frames.empty()) {
+        std::cerr << "no frames in " << corpus_path << std::endl;
+        return 1;
+    }
+
+    // Inputs for the microbenchmarks, prepared up front
+    std::vector<json> notes;
+    std::vector<std::pair<std::string, json>> events;
+    for (const auto& f : frames) {
+        json msg = json::parse(f);
+        const json& body = msg["body"];
+        if (body.value("type", "") == "note" || body.value("type", "") == "mention") {
+            notes.push_back(body["body"]);
+            events.emplace_back("note", json{{"channel", body.value("id", "")}, {"note", extract_note(body["body"])}});
+        }
+    }
+
+    size_t bytes = 0;
+    for (const auto& f : frames) bytes += f.size();
+    std::fprintf(stderr, "%zu frames (%zu bytes avg), %zu notes, %d iterations\n\n",
+                 frames.size(), bytes / frames.size(), notes.size(), iterations);
+
+    silence_stdout();
+
+    {
+        EventHandler handler;
+        handler.start();
+        run("handle (jsonl)", iterations, [&](int i) { handler.handle(frames[i % frames.size()]); });
+    }
+    {
+        EventHandler handler;
+        handler.format = OutputFormat::Human;
+        handler.start();
+        run("handle (human)", iterations, [&](int i) { handler.handle(frames[i % frames.size()]); });
+    }
+    {
+        // Timeline notes are rejected by the raw-frame prefilter
+        EventHandler handler;
+        handler.filter = EventFilter::compile("channel == \"main\"");
+        handler.start();
+        run("handle (filtered)", iterations, [&](int i) { handler.handle(frames[i % frames.size()]); });
+    }
+
+    run("extract_note", iterations, [&](int i) {
+        json n = extract_note(notes[i % notes.size()]);
+        (void)n;
+    });
+    run("now_iso8601", iterations, [&](int) {
+        std::string ts = now_iso8601();
+        (void)ts;
+    });
+    run("format_human", iterations, [&](int i) {
+        const auto& [event, data] = events[i % events.size()];
+        std::string line = format_human(event, data);
+        (void)line;
+    });
+    run("event_line", iterations, [&](int i) {
+        const auto& [event, data] = events[i % events.size()];
+        event_line(event, data);
+    });
+
+    // Output formats: size and encode/decode cost of the same events
+    std::fprintf(stderr, "\n");
+    size_t jsonl_bytes = 0;
+    for (auto [format, name] : {std::pair{OutputFormat::JSONL, "jsonl"},
+                                std::pair{OutputFormat::MsgPack, "msgpack"},
+                                std::pair{OutputFormat::CBOR, "cbor"}}) {
+        std::vector<std::string> encoded;
+        size_t total = 0;
+        for (const auto& [event, data] : events) {
+            encoded.push_back(encode_event(format, event, data));
+            total += encoded.back().size() + std::strlen(record_end(format));
+        }
+        if (format == OutputFormat::JSONL) jsonl_bytes = total;
+        std::fprintf(stderr, "%-26s %12.1f bytes/event (%.0f%% of jsonl)\n",
+                     name, static_cast<double>(total) / static_cast<double>(events.size()),
+                     100.0 * static_cast<double>(total) / static_cast<double>(jsonl_bytes));
+
+        std::string encode_name = std::string("encode ") + name;
+        run(encode_name.c_str(), iterations, [&](int i) {
+            const auto& [event, data] = events[i % events.size()];
+            encode_event(format, event, data);
+        });
+        std::string decode_name = std::string("decode ") + name;
+        run(decode_name.c_str(), iterations, [&](int i) {
+            const std::string& rec = encoded[i % encoded.size()];
+            json j = format == OutputFormat::JSONL ? json::parse(rec)
+                   : format == OutputFormat::MsgPack ? json::from_msgpack(rec.begin() + 4, rec.end())
+                   : json::from_cbor(rec.begin() + 4, rec.end());
+            (void)j;
+        });
+    }
+
+    {
+        CommandExecutor command;
+        command.config.enabled = true;
+        command.config.mode = "persistent";
+#ifdef _WIN32
+        command.config.program = "cmd";
+        command.config.args = {"/c", "more > NUL"};
+#else
+        command.config.program = "/bin/sh";
+        command.config.args = {"-c", "cat > /dev/null"};
+#endif
+        command.config.max_queue_size = 4096;
+        command.start();
+        run("CommandExecutor::send", iterations, [&](int i) {
+            const auto& [event, data] = events[i % events.size()];
+            command.send(event, data);
+        });
+        command.stop();
+    }
+    return 0;
+}
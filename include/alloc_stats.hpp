@@ -0,0 +1,19 @@
+#ifndef ALLOC_STATS
+#define ALLOC_STATS
+
+#include <cstdint>
+
+namespace Misskey {
+
+    // Heap allocations made by the current thread
+    // Only counted in builds with MISSKEY_ALLOC_STATS (xmake f --alloc_stats=y),
+    // where src/main.cpp replaces the global operator new; always 0 otherwise.
+    inline thread_local uint64_t thread_allocs = 0;
+
+    inline uint64_t alloc_count() {
+        return thread_allocs;
+    }
+
+} // namespace Misskey
+
+#endif // ALLOC_STATS
@@ -0,0 +1,274 @@
+#ifndef API_DISPATCH
+#define API_DISPATCH
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <initializer_list>
+#include <nlohmann/json.hpp>
+#include "misskey.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Error object in the same shape Misskey uses
+    inline json dispatch_error(const std::string& code, const std::string& message) {
+        return json{{"error", {{"code", code}, {"message", message}}}};
+    }
+
+    namespace detail {
+        inline std::string require_str(const json& cmd, const char* key) {
+            if (!cmd.contains(key) || !cmd[key].is_string() || cmd[key].get<std::string>().empty()) {
+                throw std::invalid_argument(std::string("missing field '") + key + "'");
+            }
+            return cmd[key].get<std::string>();
+        }
+
+        // Copy the listed fields from cmd into body when present
+        inline void copy_fields(const json& cmd, json& body, std::initializer_list<const char*> keys) {
+            for (const char* k : keys) {
+                if (cmd.contains(k) && !cmd[k].is_null()) body[k] = cmd[k];
+            }
+        }
+
+        // notes/create body from a post-like command
+        inline json note_body(const json& cmd) {
+            json body;
+            copy_fields(cmd, body, {"text", "cw", "replyId", "renoteId", "visibleUserIds", "poll", "fileIds"});
+            if (cmd.contains("quoteId") && !cmd["quoteId"].is_null()) body["renoteId"] = cmd["quoteId"];
+            body["visibility"] = cmd.value("visibility", "public");
+            return body;
+        }
+    }
+
+    // Endpoint and body for a JSON command
+    struct ApiCall {
+        std::string endpoint;
+        json body;
+    };
+
+    // Translate a plain command (everything except upload/post-image) into an
+    // API call. Throws std::invalid_argument on missing fields; returns an
+    // empty endpoint for unknown commands.
+    inline ApiCall make_api_call(const std::string& name, const json& cmd) {
+        using detail::require_str;
+
+        if (name == "post") {
+            return {"notes/create", detail::note_body(cmd)};
+
+        } else if (name == "reply") {
+            json body = detail::note_body(cmd);
+            body["replyId"] = require_str(cmd, "noteId");
+            body["text"] = require_str(cmd, "text");
+            return {"notes/create", body};
+
+        } else if (name == "quote") {
+            json body = detail::note_body(cmd);
+            body["renoteId"] = require_str(cmd, "noteId");
+            body["text"] = require_str(cmd, "text");
+            return {"notes/create", body};
+
+        } else if (name == "renote" || name == "rn") {
+            return {"notes/create", {{"renoteId", require_str(cmd, "noteId")}}};
+
+        } else if (name == "delete") {
+            return {"notes/delete", {{"noteId", require_str(cmd, "noteId")}}};
+
+        } else if (name == "show") {
+            return {"notes/show", {{"noteId", require_str(cmd, "noteId")}}};
+
+        } else if (name == "timeline" || name == "tl") {
+            json body = {{"limit", cmd.value("limit", 10)}};
+            detail::copy_fields(cmd, body, {"sinceId", "untilId"});
+            return {api::timeline_endpoint(cmd.value("type", "hybrid")), body};
+
+        } else if (name == "search") {
+            json body = {{"query", require_str(cmd, "query")}, {"limit", cmd.value("limit", 10)}};
+            detail::copy_fields(cmd, body, {"sinceId", "untilId"});
+            return {"notes/search", body};
+
+        } else if (name == "react") {
+            return {"notes/reactions/create",
+                    {{"noteId", require_str(cmd, "noteId")}, {"reaction", require_str(cmd, "reaction")}}};
+
+        } else if (name == "unreact") {
+            return {"notes/reactions/delete", {{"noteId", require_str(cmd, "noteId")}}};
+
+        } else if (name == "vote") {
+            if (!cmd.contains("choice") || !cmd["choice"].is_number_integer()) {
+                throw std::invalid_argument("missing field 'choice'");
+            }
+            return {"notes/polls/vote", {{"noteId", require_str(cmd, "noteId")}, {"choice", cmd["choice"]}}};
+
+        } else if (name == "notif" || name == "notifications") {
+            json body = {{"limit", cmd.value("limit", 10)}};
+            detail::copy_fields(cmd, body, {"sinceId", "untilId"});
+            return {"i/notifications", body};
+
+        } else if (name == "user") {
+            json body = {{"username", require_str(cmd, "username")}};
+            detail::copy_fields(cmd, body, {"host"});
+            return {"users/show", body};
+
+        } else if (name == "me") {
+            return {"i", json::object()};
+
+        } else if (name == "follow") {
+            return {"following/create", {{"userId", require_str(cmd, "userId")}}};
+
+        } else if (name == "unfollow") {
+            return {"following/delete", {{"userId", require_str(cmd, "userId")}}};
+
+        } else if (name == "block") {
+            return {"blocking/create", {{"userId", require_str(cmd, "userId")}}};
+
+        } else if (name == "unblock") {
+            return {"blocking/delete", {{"userId", require_str(cmd, "userId")}}};
+
+        } else if (name == "api") {
+            return {require_str(cmd, "endpoint"), cmd.value("body", json::object())};
+        }
+
+        return {};
+    }
+
+    // Run one JSON command such as {"cmd":"react","noteId":"...","reaction":"..."}
+    // Field names follow the Misskey API. `cb` receives the API response or an
+    // {"error":...} object, either on the engine thread or before this returns.
+    //
+    // Commands: post, reply, quote, renote, delete, show, timeline, search,
+    // react, unreact, vote, notif, user, me, follow, unfollow, block, unblock,
+    // upload, post-image, and api ({"endpoint":..,"body":{..}}) for anything else.
+    inline void dispatch_command(const api& client, const json& cmd, AsyncEngine::Callback cb) {
+        auto cmd_field = cmd.find("cmd");
+        if (cmd_field == cmd.end() || !cmd_field->is_string()) {
+            cb(dispatch_error("invalid_argument", cmd_field == cmd.end() ? "missing field 'cmd'"
+                                                                         : "field 'cmd' must be a string"));
+            return;
+        }
+        const std::string& name = cmd_field->get_ref<const std::string&>();
+
+        if (name == "upload" || name == "post-image" || name == "pi") {
+            if (!cmd.contains("file") || !cmd["file"].is_string()) {
+                cb(dispatch_error("invalid_argument", "missing field 'file'"));
+                return;
+            }
+            std::string file = cmd["file"].get<std::string>();
+            std::string upload_name, folder_id;
+            bool nsfw = false;
+            json body;
+            try {
+                upload_name = cmd.value("name", "");
+                folder_id = cmd.value("folderId", "");
+                nsfw = cmd.value("nsfw", false);
+                body = detail::note_body(cmd);
+            } catch (const std::exception& e) {
+                cb(dispatch_error("invalid_argument", e.what()));
+                return;
+            }
+
+            if (name == "upload") {
+                client.drive_upload_async(file, upload_name, folder_id, nsfw, std::move(cb));
+                return;
+            }
+
+            // Upload first, then create the note from the upload callback
+            client.drive_upload_async(file, "", "", nsfw,
+                [&client, body = std::move(body), cb = std::move(cb)](json uploaded) mutable {
+                    std::string file_id = uploaded.value("id", "");
+                    if (uploaded.contains("error") || file_id.empty()) {
+                        cb(uploaded.contains("error") ? std::move(uploaded)
+                                                      : dispatch_error("upload_failed", "no file ID returned"));
+                        return;
+                    }
+                    body["fileIds"] = json::array({file_id});
+                    client.post_async("notes/create", std::move(body), std::move(cb));
+                });
+            return;
+        }
+
+        ApiCall call;
+        try {
+            call = make_api_call(name, cmd);
+        } catch (const std::exception& e) {
+            cb(dispatch_error("invalid_argument", e.what()));
+            return;
+        }
+        if (call.endpoint.empty()) {
+            cb(dispatch_error("unknown_command", "unknown command '" + name + "'"));
+            return;
+        }
+        client.post_async(call.endpoint, std::move(call.body), std::move(cb));
+    }
+
+    // Read one JSON command per line from `in` and write one JSON result per
+    // line to `out`, tagged with the command's "id". Up to `concurrency`
+    // commands run at once; above 1, results come back in completion order.
+    inline int run_batch(const api& client, std::istream& in, std::ostream& out, int concurrency = 1) {
+        if (concurrency < 1) concurrency = 1;
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        int in_flight = 0;
+
+        auto write_result = [&](const json& id, json result) {
+            json line;
+            line["id"] = id;
+            if (result.contains("error")) {
+                line["ok"] = false;
+                line["error"] = std::move(result["error"]);
+            } else {
+                line["ok"] = true;
+                line["result"] = std::move(result);
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            out << line.dump(-1, ' ', false, json::error_handler_t::replace) << '\n';
+            out.flush();
+        };
+
+        std::string raw;
+        while (std::getline(in, raw)) {
+            if (raw.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+            json cmd;
+            try {
+                cmd = json::parse(raw);
+            } catch (const json::parse_error& e) {
+                write_result(nullptr, dispatch_error("invalid_json", e.what()));
+                continue;
+            }
+            if (!cmd.is_object()) {
+                write_result(nullptr, dispatch_error("invalid_json", "command must be an object"));
+                continue;
+            }
+            json id = cmd.value("id", json(nullptr));
+
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return in_flight < concurrency; });
+                in_flight++;
+            }
+
+            dispatch_command(client, cmd, [&, id](json result) {
+                write_result(id, std::move(result));
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    in_flight--;
+                }
+                cv.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return in_flight == 0; });
+        return 0;
+    }
+
+} // namespace Misskey
+
+#endif // API_DISPATCH
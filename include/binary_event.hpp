@@ -0,0 +1,106 @@
+#ifndef BINARY_EVENT
+#define BINARY_EVENT
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "jsonl_writer.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Length-prefixed binary events
+    //
+    // Same schema as event_line(), {"ts":..,"event":..,"data":..} plus
+    // "account" when set, encoded as MessagePack or CBOR and preceded by its
+    // size as a 4-byte big-endian integer, so a reader takes 4 bytes, then
+    // that many bytes, and decodes.
+    namespace detail {
+        struct BinaryEventWriter {
+            std::string buf;
+            nlohmann::detail::binary_writer<json, char> writer{
+                std::make_shared<nlohmann::detail::output_string_adapter<char>>(buf)};
+            std::string ts;
+        };
+
+        inline void append_be(std::string& out, uint64_t v, int bytes) {
+            for (int i = bytes - 1; i >= 0; i--) out += static_cast<char>((v >> (8 * i)) & 0xff);
+        }
+
+        // String header (shortest form) followed by the bytes
+        inline void msgpack_str(std::string& out, std::string_view s) {
+            if (s.size() < 32) out += static_cast<char>(0xa0 | s.size());
+            else if (s.size() <= 0xff) { out += static_cast<char>(0xd9); append_be(out, s.size(), 1); }
+            else if (s.size() <= 0xffff) { out += static_cast<char>(0xda); append_be(out, s.size(), 2); }
+            else { out += static_cast<char>(0xdb); append_be(out, s.size(), 4); }
+            out.append(s);
+        }
+
+        inline void cbor_str(std::string& out, std::string_view s) {
+            if (s.size() < 24) out += static_cast<char>(0x60 | s.size());
+            else if (s.size() <= 0xff) { out += static_cast<char>(0x78); append_be(out, s.size(), 1); }
+            else if (s.size() <= 0xffff) { out += static_cast<char>(0x79); append_be(out, s.size(), 2); }
+            else { out += static_cast<char>(0x7a); append_be(out, s.size(), 4); }
+            out.append(s);
+        }
+
+        inline void patch_length(std::string& buf) {
+            uint64_t len = buf.size() - 4;
+            for (int i = 0; i < 4; i++) buf[static_cast<size_t>(i)] = static_cast<char>((len >> (8 * (3 - i))) & 0xff);
+        }
+    }
+
+    // Serialise one event as a length-prefixed MessagePack map
+    // Like event_line(), the buffer belongs to the calling thread and is
+    // reused; the reference is valid until the next call on this thread.
+    inline const std::string& event_msgpack(std::string_view event, const json& data,
+                                            std::string_view account = {}) {
+        thread_local detail::BinaryEventWriter w;
+        w.ts.clear();
+        append_timestamp(w.ts);
+
+        w.buf.assign(4, '\0');
+        w.buf += static_cast<char>(account.empty() ? 0x83 : 0x84); // fixmap of 3 or 4
+        detail::msgpack_str(w.buf, "ts");
+        detail::msgpack_str(w.buf, w.ts);
+        if (!account.empty()) {
+            detail::msgpack_str(w.buf, "account");
+            detail::msgpack_str(w.buf, account);
+        }
+        detail::msgpack_str(w.buf, "event");
+        detail::msgpack_str(w.buf, event);
+        detail::msgpack_str(w.buf, "data");
+        w.writer.write_msgpack(data);
+        detail::patch_length(w.buf);
+        return w.buf;
+    }
+
+    // Serialise one event as a length-prefixed CBOR map
+    inline const std::string& event_cbor(std::string_view event, const json& data,
+                                         std::string_view account = {}) {
+        thread_local detail::BinaryEventWriter w;
+        w.ts.clear();
+        append_timestamp(w.ts);
+
+        w.buf.assign(4, '\0');
+        w.buf += static_cast<char>(account.empty() ? 0xa3 : 0xa4); // map of 3 or 4
+        detail::cbor_str(w.buf, "ts");
+        detail::cbor_str(w.buf, w.ts);
+        if (!account.empty()) {
+            detail::cbor_str(w.buf, "account");
+            detail::cbor_str(w.buf, account);
+        }
+        detail::cbor_str(w.buf, "event");
+        detail::cbor_str(w.buf, event);
+        detail::cbor_str(w.buf, "data");
+        w.writer.write_cbor(data);
+        detail::patch_length(w.buf);
+        return w.buf;
+    }
+
+} // namespace Misskey
+
+#endif // BINARY_EVENT
@@ -0,0 +1,343 @@
+#ifndef CHILD_REAPER
+#define CHILD_REAPER
+
+#ifdef __linux__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+namespace Misskey {
+
+    // Supervises many child processes from one thread
+    // Child exit is observed through a pidfd in epoll (Linux 5.3+), or a
+    // SIGCHLD self-pipe on older kernels. Feeding the child's stdin and the
+    // kill-on-timeout are driven by the same epoll loop, so nothing polls.
+    class ChildReaper {
+    public:
+        struct Result {
+            int status = 0;           // waitpid status
+            bool timed_out = false;   // killed after the timeout
+            std::chrono::nanoseconds elapsed{0}; // spawn to exit
+        };
+        using Callback = std::function<void(const Result&)>;
+
+        ChildReaper() = default;
+
+        ~ChildReaper() {
+            stop();
+        }
+
+        ChildReaper(const ChildReaper&) = delete;
+        ChildReaper& operator=(const ChildReaper&) = delete;
+
+        bool start() {
+            epfd = epoll_create1(EPOLL_CLOEXEC);
+            wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epfd == -1 || wakefd == -1) {
+                std::cerr << "[CMD] epoll/eventfd failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+            add_fd(wakefd, EPOLLIN, wake_key);
+
+            // Probe for pidfd support; fall back to a SIGCHLD self-pipe
+            int probe = pidfd_open(getpid());
+            if (probe >= 0) {
+                close(probe);
+            } else if (!install_sigchld_pipe()) {
+                return false;
+            } else {
+                add_fd(sigchld_pipe()[0], EPOLLIN, sigchld_key);
+                use_pidfd = false;
+            }
+
+            running = true;
+            thread = std::thread(&ChildReaper::loop, this);
+            return true;
+        }
+
+        void stop() {
+            if (!running.exchange(false)) return;
+            wake();
+            if (thread.joinable()) thread.join();
+
+            // Anything still running is killed and reaped synchronously
+            for (auto& [id, c] : children) {
+                kill(c.pid, SIGKILL);
+                int status = 0;
+                waitpid(c.pid, &status, 0);
+                close_child_fds(c);
+                if (c.cb) c.cb(Result{status, true, since(c.started)});
+            }
+            children.clear();
+            if (wakefd != -1) close(wakefd);
+            if (epfd != -1) close(epfd);
+            wakefd = epfd = -1;
+        }
+
+        // Supervise `pid`: write `input` to `stdin_fd` and close it, kill the
+        // child after `timeout_ms`, then call cb on the reaper thread once it
+        // has been reaped. Takes ownership of stdin_fd.
+        void watch(pid_t pid, int stdin_fd, std::string input, int timeout_ms,
+                   std::chrono::steady_clock::time_point started, Callback cb) {
+            Child c;
+            c.pid = pid;
+            c.stdin_fd = stdin_fd;
+            c.input = std::move(input);
+            c.started = started;
+            c.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            c.cb = std::move(cb);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                incoming.push_back(std::move(c));
+            }
+            wake();
+        }
+
+    private:
+        struct Child {
+            pid_t pid = -1;
+            int pidfd = -1;
+            int stdin_fd = -1;
+            std::string input;
+            size_t written = 0;
+            bool timed_out = false;
+            std::chrono::steady_clock::time_point started;
+            std::chrono::steady_clock::time_point deadline;
+            Callback cb;
+        };
+
+        // epoll keys: child id << 2 | kind
+        static constexpr uint64_t kind_exit = 0;
+        static constexpr uint64_t kind_stdin = 1;
+        static constexpr uint64_t wake_key = 2;
+        static constexpr uint64_t sigchld_key = 3;
+
+        int epfd = -1;
+        int wakefd = -1;
+        bool use_pidfd = true;
+        std::atomic<bool> running{false};
+        std::thread thread;
+        std::mutex mtx;
+        std::vector<Child> incoming;
+        std::unordered_map<uint64_t, Child> children; // reaper thread only
+        uint64_t next_id = 1;
+
+        static int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+            return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+            (void)pid;
+            errno = ENOSYS;
+            return -1;
+#endif
+        }
+
+        static int* sigchld_pipe() {
+            static int fds[2] = {-1, -1};
+            return fds;
+        }
+
+        static void on_sigchld(int) {
+            int saved = errno;
+            char c = 0;
+            ssize_t n = write(sigchld_pipe()[1], &c, 1);
+            (void)n;
+            errno = saved;
+        }
+
+        static bool install_sigchld_pipe() {
+            int* fds = sigchld_pipe();
+            if (fds[0] != -1) return true;
+            if (pipe(fds) == -1) {
+                std::cerr << "[CMD] pipe() failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+            for (int i = 0; i < 2; i++) {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            }
+            struct sigaction sa;
+            std::memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = &ChildReaper::on_sigchld;
+            sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGCHLD, &sa, nullptr);
+            return true;
+        }
+
+        static std::chrono::nanoseconds since(std::chrono::steady_clock::time_point t) {
+            return std::chrono::steady_clock::now() - t;
+        }
+
+        void add_fd(int fd, uint32_t events, uint64_t key) {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.u64 = key;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        void wake() {
+            uint64_t one = 1;
+            ssize_t n = write(wakefd, &one, sizeof(one));
+            (void)n;
+        }
+
+        void close_child_fds(Child& c) {
+            if (c.stdin_fd != -1) {
+                close(c.stdin_fd);
+                c.stdin_fd = -1;
+            }
+            if (c.pidfd != -1) {
+                close(c.pidfd);
+                c.pidfd = -1;
+            }
+        }
+
+        // Push as much stdin as the pipe takes; close it when done or broken
+        void feed_stdin(uint64_t id, Child& c) {
+            while (c.written < c.input.size()) {
+                ssize_t n = write(c.stdin_fd, c.input.data() + c.written, c.input.size() - c.written);
+                if (n > 0) {
+                    c.written += static_cast<size_t>(n);
+                    continue;
+                }
+                if (n == -1 && errno == EINTR) continue;
+                if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    add_fd(c.stdin_fd, EPOLLOUT, id << 2 | kind_stdin);
+                    return;
+                }
+                break; // EPIPE: the child is not reading
+            }
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c.stdin_fd, nullptr);
+            close(c.stdin_fd);
+            c.stdin_fd = -1;
+        }
+
+        void adopt_incoming() {
+            std::vector<Child> batch;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                batch.swap(incoming);
+            }
+            for (auto& c : batch) {
+                uint64_t id = next_id++;
+                fcntl(c.stdin_fd, F_SETFL, fcntl(c.stdin_fd, F_GETFL) | O_NONBLOCK);
+                if (use_pidfd) {
+                    c.pidfd = pidfd_open(c.pid);
+                    if (c.pidfd >= 0) {
+                        add_fd(c.pidfd, EPOLLIN, id << 2 | kind_exit);
+                    } else {
+                        std::cerr << "[CMD] pidfd_open failed: " << strerror(errno)
+                                  << ", reaping at timeout" << std::endl;
+                    }
+                }
+                auto& stored = children.emplace(id, std::move(c)).first->second;
+                feed_stdin(id, stored);
+                // The child may have exited before we got here (no pidfd or a
+                // SIGCHLD we already drained), so check once right away
+                try_reap(id);
+            }
+        }
+
+        // Reap the child if it has exited; returns true when it is gone
+        bool try_reap(uint64_t id, bool block = false) {
+            auto it = children.find(id);
+            if (it == children.end()) return true;
+            Child& c = it->second;
+
+            int status = 0;
+            pid_t r = waitpid(c.pid, &status, block ? 0 : WNOHANG);
+            if (r == 0) return false;
+
+            if (c.stdin_fd != -1) epoll_ctl(epfd, EPOLL_CTL_DEL, c.stdin_fd, nullptr);
+            if (c.pidfd != -1) epoll_ctl(epfd, EPOLL_CTL_DEL, c.pidfd, nullptr);
+            close_child_fds(c);
+
+            Result res{status, c.timed_out, since(c.started)};
+            Callback cb = std::move(c.cb);
+            children.erase(it);
+            if (cb) cb(res);
+            return true;
+        }
+
+        // Kill children past their deadline; returns ms until the next one
+        int enforce_deadlines() {
+            auto now = std::chrono::steady_clock::now();
+            auto next = std::chrono::steady_clock::time_point::max();
+            std::vector<uint64_t> unwatched;
+            for (auto& [id, c] : children) {
+                if (c.timed_out) continue;
+                if (now >= c.deadline) {
+                    kill(c.pid, SIGKILL);
+                    c.timed_out = true;
+                    // No pidfd to tell us about the exit: reap it here
+                    if (use_pidfd && c.pidfd == -1) unwatched.push_back(id);
+                } else if (c.deadline < next) {
+                    next = c.deadline;
+                }
+            }
+            for (uint64_t id : unwatched) try_reap(id, true);
+            if (next == std::chrono::steady_clock::time_point::max()) return -1;
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+            return static_cast<int>(std::min<long long>(ms, INT_MAX));
+        }
+
+        void loop() {
+            epoll_event events[32];
+            while (running) {
+                int timeout = enforce_deadlines();
+                int n = epoll_wait(epfd, events, 32, timeout);
+                if (n == -1 && errno != EINTR) {
+                    std::cerr << "[CMD] epoll_wait failed: " << strerror(errno) << std::endl;
+                    break;
+                }
+
+                for (int i = 0; i < n; i++) {
+                    uint64_t key = events[i].data.u64;
+                    if (key == wake_key) {
+                        uint64_t v;
+                        while (read(wakefd, &v, sizeof(v)) > 0) {}
+                        adopt_incoming();
+                    } else if (key == sigchld_key) {
+                        char buf[64];
+                        while (read(sigchld_pipe()[0], buf, sizeof(buf)) > 0) {}
+                        std::vector<uint64_t> ids;
+                        for (const auto& [id, c] : children) ids.push_back(id);
+                        for (uint64_t id : ids) try_reap(id);
+                    } else if ((key & 3) == kind_stdin) {
+                        auto it = children.find(key >> 2);
+                        if (it != children.end() && it->second.stdin_fd != -1) {
+                            epoll_ctl(epfd, EPOLL_CTL_DEL, it->second.stdin_fd, nullptr);
+                            feed_stdin(key >> 2, it->second);
+                        }
+                    } else {
+                        try_reap(key >> 2);
+                    }
+                }
+            }
+        }
+    };
+
+} // namespace Misskey
+
+#endif // __linux__
+
+#endif // CHILD_REAPER
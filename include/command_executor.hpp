@@ -2,24 +2,37 @@
 #define COMMAND_EXECUTOR
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <unordered_set>
 #include <iostream>
 #include <sstream>
 #include <functional>
 #include <thread>
 #include <mutex>
-#include <queue>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <fstream>
 #include <nlohmann/json.hpp>
+#include "ring_buffer.hpp"
+#include "jsonl_writer.hpp"
+#include "metrics.hpp"
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <cstring>
+#include <future>
+#include "child_reaper.hpp"
 #endif
 
 using json = nlohmann::json;
@@ -31,14 +44,30 @@ namespace Misskey {
         std::string program;           // e.g. "openclaw"
         std::vector<std::string> args;  // e.g. ["message", "send"]
         std::vector<std::string> events; // which events to forward (empty = all)
-        int max_queue_size = 100;       // drop oldest if queue overflows
+        int max_queue_size = 100;       // per worker
+        std::string overflow = "drop_oldest"; // when a queue is full: "drop_oldest",
+                                              // "drop_newest", "block" or "spill"
+        int block_timeout_ms = 100;     // "block": give up (drop newest) after this long
+        std::string spill_path = "command_spill.jsonl"; // "spill": append overflow here
+        int workers = 1;                // commands run concurrently on this many workers
+        std::string order_key;          // e.g. "data.note.user.id": events with the same
+                                        // value run in order on one worker (empty = none)
+        int timeout_ms = 10000;         // kill a spawned command after this long
+        std::string mode = "spawn";     // "spawn" = one process per event,
+                                        // "persistent" = one long-lived process fed JSONL on stdin
+        int shutdown_timeout_ms = 5000; // drain(): time queued events get to run on shutdown
+        std::string shutdown_leftover = "spill"; // drain(): what is still queued then, "spill" or "drop"
     };
 
     // Execute an external command with JSON piped to stdin
-    // Runs in a worker thread to avoid blocking the WebSocket loop
+    // Runs on a pool of worker threads to avoid blocking the WebSocket loop.
+    // Each worker has its own queue; with an order key, events that share a
+    // key always go to the same worker and so run in arrival order.
     class CommandExecutor {
     public:
         CommandConfig config;
+        Metrics* metrics = nullptr;   // stage latencies are recorded here when set
+        std::string line_end = "\n";  // appended to every payload ("" for length-prefixed binary)
 
         explicit CommandExecutor() = default;
 
@@ -48,67 +77,397 @@ namespace Misskey {
 
         void start() {
             if (!config.enabled) return;
+#ifndef _WIN32
+            // A child that exits before reading its stdin would otherwise
+            // kill us with SIGPIPE on the next write
+            signal(SIGPIPE, SIG_IGN);
+#endif
+            order_key_path = split_path(config.order_key);
+            event_set = std::unordered_set<std::string>(config.events.begin(), config.events.end());
+#ifdef __linux__
+            reaper_ok = !persistent() && reaper.start();
+#endif
             running = true;
-            worker = std::thread(&CommandExecutor::worker_loop, this);
+
+            int n = std::max(config.workers, 1);
+            size_t capacity = static_cast<size_t>(std::max(config.max_queue_size, 1));
+            for (int i = 0; i < n; i++) {
+                auto w = std::make_unique<Worker>(capacity);
+                w->index = static_cast<size_t>(i);
+                w->last_change = std::chrono::steady_clock::now();
+                workers.push_back(std::move(w));
+            }
+            for (auto& w : workers) {
+                w->thread = std::thread(&CommandExecutor::worker_loop, this, std::ref(*w));
+            }
         }
 
         void stop() {
             if (!running) return;
             running = false;
-            cv.notify_all();
-            if (worker.joinable()) worker.join();
+            for (auto& w : workers) {
+                {
+                    // Pairs with the backoff wait predicate so no worker misses the wakeup
+                    std::lock_guard<std::mutex> lock(w->mtx);
+                }
+                w->cv.notify_all();
+                w->signal.fetch_add(1, std::memory_order_release);
+                w->signal.notify_all();
+            }
+            for (auto& w : workers) {
+                if (w->thread.joinable()) w->thread.join();
+                stop_persistent(*w);
+            }
+#ifdef __linux__
+            reaper.stop();
+#endif
+            if (workers.size() > 1) {
+                for (const auto& w : workers) {
+                    std::cerr << "[CMD] worker " << w->index << ": busy "
+                              << w->busy_ns / 1000000 << "ms, idle "
+                              << w->idle_ns / 1000000 << "ms, "
+                              << w->processed << " processed" << std::endl;
+                }
+            }
         }
 
-        // Enqueue an event JSON to be sent to the external command
-        void send(const std::string& event, const json& data) {
-            if (!config.enabled || !running) return;
+        // Final stop on shutdown: let the workers work through their queues
+        // for up to `timeout`, then stop them and spill (or drop) what is left
+        // A command still running at the deadline is waited for (spawned ones
+        // at most timeout_ms) before the workers are joined. A negative
+        // timeout waits until everything has run.
+        json drain(std::chrono::milliseconds timeout) {
+            json result{{"drained", 0}, {"spilled", 0}, {"dropped", 0}};
+            if (!running) return result;
+
+            uint64_t processed_before = total_processed();
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while ((queued() > 0 || in_flight.load() > 0) &&
+                   (timeout.count() < 0 || std::chrono::steady_clock::now() < deadline)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            stop();
 
-            // Filter by event type if configured
-            if (!config.events.empty()) {
-                bool match = false;
-                for (const auto& e : config.events) {
-                    if (e == event) { match = true; break; }
+            uint64_t spilled_before = spilled.load(), dropped_before = dropped.load();
+            QueuedLine left;
+            for (auto& w : workers) {
+                while (w->ring.try_pop(left)) {
+                    if (config.shutdown_leftover == "spill") spill(left.line);
+                    else dropped++;
                 }
-                if (!match) return;
             }
+            result["drained"] = total_processed() - processed_before;
+            result["spilled"] = spilled.load() - spilled_before;
+            result["dropped"] = dropped.load() - dropped_before;
+            return result;
+        }
 
-            json payload;
-            payload["event"] = event;
-            payload["data"] = data;
-            std::string line = payload.dump(-1, ' ', false, json::error_handler_t::replace);
+        // Lines waiting in all worker queues
+        size_t queued() const {
+            size_t n = 0;
+            for (const auto& w : workers) n += w->ring.size();
+            return n;
+        }
 
-            {
-                std::lock_guard<std::mutex> lock(mtx);
-                if (static_cast<int>(queue_.size()) >= config.max_queue_size) {
-                    queue_.pop(); // drop oldest
-                }
-                queue_.push(std::move(line));
+        // Per-worker busy/idle time (to size the pool) and spawn-to-exit latency
+        json stats() const {
+            json arr = json::array();
+            for (const auto& w : workers) {
+                arr.push_back({
+                    {"worker", w->index},
+                    {"busyMs", w->busy_ns.load() / 1000000},
+                    {"idleMs", w->idle_ns.load() / 1000000},
+                    {"processed", w->processed.load()},
+                    {"queued", w->ring.size()},
+                });
             }
-            cv.notify_one();
+            uint64_t count = exec_count.load();
+            json exec;
+            exec["count"] = count;
+            exec["timeouts"] = exec_timeouts.load();
+            exec["avgMs"] = count ? static_cast<double>(exec_total_ns.load()) / static_cast<double>(count) / 1e6 : 0.0;
+            exec["maxMs"] = static_cast<double>(exec_max_ns.load()) / 1e6;
+            json queue;
+            queue["overflow"] = config.overflow;
+            queue["dropped"] = dropped.load();
+            queue["spilled"] = spilled.load();
+            return json{{"workers", arr}, {"exec", exec}, {"queue", queue}};
         }
 
+        // Whether send() would forward this event at all
+        bool wants(const std::string& event) const {
+            if (!config.enabled || !running) return false;
+            return event_set.empty() || event_set.count(event) > 0;
+        }
+
+        // Enqueue an event JSON to be sent to the external command
+        void send(const std::string& event, const json& data) {
+            if (!wants(event)) return;
+            send_line(event, data, event_line(event, data));
+        }
+
+        // Enqueue an already serialised event line (see event_line())
+        // `data` is only used to pick the worker. The line is copied into the
+        // queue slot, whose buffer is reused, so this does not allocate once
+        // the queue has warmed up.
+        void send_line(const std::string& event, const json& data, const std::string& line) {
+            if (!wants(event)) return;
+            enqueue(pick_worker(event, data), line);
+        }
+
+        // Drops and spills not yet reported, at most once per second
+        // Returns false when there is nothing new to report.
+        bool take_overflow_report(uint64_t& new_dropped, uint64_t& new_spilled) {
+            auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            auto last = last_report.load(std::memory_order_relaxed);
+            if (now - last < std::chrono::steady_clock::duration(std::chrono::seconds(1)).count()) return false;
+
+            uint64_t d = dropped.load(), sp = spilled.load();
+            uint64_t rd = reported_dropped.load(), rs = reported_spilled.load();
+            if (d == rd && sp == rs) return false;
+            if (!last_report.compare_exchange_strong(last, now)) return false;
+
+            reported_dropped = d;
+            reported_spilled = sp;
+            new_dropped = d - rd;
+            new_spilled = sp - rs;
+            return true;
+        }
+
+        uint64_t total_dropped() const { return dropped.load(); }
+        uint64_t total_spilled() const { return spilled.load(); }
+
     private:
-        std::thread worker;
-        std::mutex mtx;
-        std::condition_variable cv;
-        std::queue<std::string> queue_;
+        static constexpr int restart_backoff_min_ms = 100;
+        static constexpr int restart_backoff_max_ms = 30000;
+        static constexpr int write_timeout_ms = 10000;
+
+        // An event line waiting for a worker
+        struct QueuedLine {
+            std::string line;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        // One worker thread with its own queue (and, in persistent mode, child)
+        struct Worker {
+            size_t index = 0;
+            std::thread thread;
+            RingBuffer<QueuedLine> ring;
+            std::atomic<uint32_t> signal{0}; // bumped on every push; the worker waits on it
+            std::mutex mtx;                  // restart backoff only
+            std::condition_variable cv;
+
+            explicit Worker(size_t capacity) : ring(capacity) {}
+
+            std::atomic<uint64_t> busy_ns{0};
+            std::atomic<uint64_t> idle_ns{0};
+            std::atomic<uint64_t> processed{0};
+            std::chrono::steady_clock::time_point last_change;
+
+            // Persistent mode state (this worker's thread only)
+            std::chrono::steady_clock::time_point child_started;
+            int restart_backoff_ms = restart_backoff_min_ms;
+            bool child_exited = false;
+#ifdef _WIN32
+            HANDLE child_process = NULL;
+            HANDLE child_stdin = NULL;
+#else
+            pid_t child_pid = -1;
+            int child_stdin = -1;
+#endif
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::string> order_key_path;
+        std::unordered_set<std::string> event_set;
         std::atomic<bool> running{false};
+        std::atomic<int> in_flight{0}; // workers holding a popped line
+
+        // Overflow accounting
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> spilled{0};
+        std::atomic<uint64_t> reported_dropped{0};
+        std::atomic<uint64_t> reported_spilled{0};
+        std::atomic<std::chrono::steady_clock::rep> last_report{0};
+        std::mutex spill_mtx;
+        std::ofstream spill_file;
+
+        // Spawn-to-exit latency of spawned commands
+        std::atomic<uint64_t> exec_count{0};
+        std::atomic<uint64_t> exec_timeouts{0};
+        std::atomic<uint64_t> exec_total_ns{0};
+        std::atomic<uint64_t> exec_max_ns{0};
+
+#ifdef __linux__
+        ChildReaper reaper;
+        bool reaper_ok = false;
+#endif
 
-        void worker_loop() {
+        void record_exec(std::chrono::nanoseconds elapsed, bool timed_out) {
+            auto ns = static_cast<uint64_t>(elapsed.count());
+            exec_count++;
+            exec_total_ns += ns;
+            if (timed_out) exec_timeouts++;
+            uint64_t prev = exec_max_ns.load();
+            while (ns > prev && !exec_max_ns.compare_exchange_weak(prev, ns)) {}
+        }
+
+        uint64_t total_processed() const {
+            uint64_t n = 0;
+            for (const auto& w : workers) n += w->processed.load();
+            return n;
+        }
+
+        bool persistent() const {
+            return config.mode == "persistent";
+        }
+
+        static std::vector<std::string> split_path(const std::string& path) {
+            std::vector<std::string> parts;
+            size_t start = 0;
+            while (start < path.size()) {
+                auto dot = path.find('.', start);
+                if (dot == std::string::npos) dot = path.size();
+                if (dot > start) parts.push_back(path.substr(start, dot - start));
+                start = dot + 1;
+            }
+            return parts;
+        }
+
+        // Look up the order key ("event" or "data.<path>") for an event
+        // Hash of the order key value; 0 when the event has none
+        size_t order_hash(const std::string& event, const json& data) const {
+            if (order_key_path.empty()) return 0;
+            if (order_key_path[0] == "event") return std::hash<std::string_view>{}(event) | 1;
+            if (order_key_path[0] != "data") return 0;
+
+            const json* cur = &data;
+            for (size_t i = 1; i < order_key_path.size(); i++) {
+                if (!cur->is_object()) return 0;
+                auto it = cur->find(order_key_path[i]);
+                if (it == cur->end()) return 0;
+                cur = &*it;
+            }
+            if (cur->is_null()) return 0;
+            if (cur->is_string()) {
+                const auto& s = cur->get_ref<const std::string&>();
+                return s.empty() ? 0 : std::hash<std::string_view>{}(s) | 1;
+            }
+            return std::hash<json>{}(*cur) | 1;
+        }
+
+        // Same key -> same worker; no key -> the least loaded worker
+        Worker& pick_worker(const std::string& event, const json& data) {
+            if (workers.size() == 1) return *workers[0];
+
+            size_t key = order_hash(event, data);
+            if (key != 0) {
+                return *workers[key % workers.size()];
+            }
+            Worker* best = workers[0].get();
+            for (auto& w : workers) {
+                if (w->ring.size() < best->ring.size()) best = w.get();
+            }
+            return *best;
+        }
+
+        // Add the time since the last state change to busy or idle
+        static void account(Worker& w, bool was_busy) {
+            auto now = std::chrono::steady_clock::now();
+            auto ns = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - w.last_change).count());
+            (was_busy ? w.busy_ns : w.idle_ns) += ns;
+            w.last_change = now;
+        }
+
+        // Push onto a worker's ring, applying the overflow policy when full
+        // Only "block" ever waits, and only if the user asked for it.
+        void enqueue(Worker& w, const std::string& line) {
+            auto now = std::chrono::steady_clock::now();
+            auto fill = [&](QueuedLine& q) {
+                q.line.assign(line);
+                q.queued = now;
+            };
+            if (!w.ring.try_push_with(fill)) {
+                if (config.overflow == "drop_newest") {
+                    dropped++;
+                    return;
+                } else if (config.overflow == "spill") {
+                    spill(line);
+                    return;
+                } else if (config.overflow == "block") {
+                    if (!push_blocking(w, fill)) {
+                        dropped++;
+                        return;
+                    }
+                } else {
+                    // drop_oldest: evict from the head until our line fits
+                    // (the evicted buffer is kept so the slot gets one back)
+                    thread_local QueuedLine evicted;
+                    while (!w.ring.try_push_with(fill)) {
+                        if (w.ring.try_pop(evicted)) dropped++;
+                    }
+                }
+            }
+            w.signal.fetch_add(1, std::memory_order_release);
+            w.signal.notify_one();
+        }
+
+        template <typename F>
+        bool push_blocking(Worker& w, F& fill) {
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(config.block_timeout_ms);
+            auto pause = std::chrono::microseconds(50);
+            while (std::chrono::steady_clock::now() < deadline && running) {
+                std::this_thread::sleep_for(pause);
+                if (w.ring.try_push_with(fill)) return true;
+                pause = std::min(pause * 2, std::chrono::microseconds(2000));
+            }
+            return false;
+        }
+
+        // Append an event we have no room for to the spill file
+        void spill(const std::string& line) {
+            std::lock_guard<std::mutex> lock(spill_mtx);
+            if (!spill_file.is_open()) {
+                spill_file.open(config.spill_path, std::ios::app | std::ios::binary);
+            }
+            if (!spill_file) {
+                dropped++;
+                return;
+            }
+            spill_file << line << line_end;
+            spill_file.flush();
+            spilled++;
+        }
+
+        void worker_loop(Worker& w) {
+            QueuedLine payload;
             while (running) {
-                std::string payload;
-                {
-                    std::unique_lock<std::mutex> lock(mtx);
-                    cv.wait(lock, [this] { return !queue_.empty() || !running; });
-                    if (!running && queue_.empty()) break;
-                    payload = std::move(queue_.front());
-                    queue_.pop();
+                uint32_t seen = w.signal.load(std::memory_order_acquire);
+                // Counted before the pop so drain() never sees an empty queue
+                // and no worker busy while a line is in hand
+                in_flight.fetch_add(1);
+                if (!w.ring.try_pop(payload)) {
+                    in_flight.fetch_sub(1);
+                    w.signal.wait(seen, std::memory_order_acquire);
+                    continue;
                 }
-                exec_command(payload);
+                if (metrics) metrics->record(Stage::QueueWait, std::chrono::steady_clock::now() - payload.queued);
+                account(w, false);
+                exec_command(w, payload.line);
+                account(w, true);
+                w.processed++;
+                in_flight.fetch_sub(1);
             }
+            account(w, false);
         }
 
-        void exec_command(const std::string& json_payload) {
+        void exec_command(Worker& w, const std::string& json_payload) {
+            if (persistent()) {
+                send_persistent(w, json_payload);
+                return;
+            }
 #ifdef _WIN32
             exec_command_win32(json_payload);
 #else
@@ -116,8 +475,59 @@ namespace Misskey {
 #endif
         }
 
+        // Persistent mode: write one event record to the long-lived child,
+        // (re)starting it with exponential backoff when it is gone
+        void send_persistent(Worker& w, const std::string& json_payload) {
+            std::string input = json_payload + line_end;
+            while (running) {
+                if (!child_alive(w)) {
+                    if (w.child_exited) {
+                        w.child_exited = false;
+                        backoff_wait(w);
+                        continue;
+                    }
+                    bool started;
+                    {
+                        StageTimer t(metrics, Stage::Spawn);
+                        started = start_child(w);
+                    }
+                    if (!started) {
+                        backoff_wait(w);
+                        continue;
+                    }
+                }
+                bool written;
+                {
+                    StageTimer t(metrics, Stage::ChildRun);
+                    written = write_child(w, input);
+                }
+                if (written) return;
+
+                std::cerr << "[CMD] persistent '" << config.program
+                          << "' stopped accepting input, restarting" << std::endl;
+                stop_persistent(w);
+                backoff_wait(w);
+            }
+        }
+
+        // Sleep before the next restart; interrupted by stop()
+        void backoff_wait(Worker& w) {
+            std::unique_lock<std::mutex> lock(w.mtx);
+            w.cv.wait_for(lock, std::chrono::milliseconds(w.restart_backoff_ms),
+                          [this] { return !running; });
+            w.restart_backoff_ms = std::min(w.restart_backoff_ms * 2, restart_backoff_max_ms);
+        }
+
+        // Reset the backoff once a child has stayed up for a while
+        void note_child_exit(Worker& w) {
+            w.child_exited = true;
+            auto lived = std::chrono::steady_clock::now() - w.child_started;
+            if (lived >= std::chrono::seconds(10)) w.restart_backoff_ms = restart_backoff_min_ms;
+        }
+
 #ifdef _WIN32
-        void exec_command_win32(const std::string& json_payload) {
+        // Start the configured program with a pipe on its stdin
+        bool spawn_win32(PROCESS_INFORMATION& pi, HANDLE& stdin_write) {
             // Build command line: program arg1 arg2 ... (JSON via stdin)
             std::string cmdline = quote_arg(config.program);
             for (const auto& arg : config.args) {
@@ -129,15 +539,15 @@ namespace Misskey {
             sa.bInheritHandle = TRUE;
             sa.lpSecurityDescriptor = NULL;
 
-            HANDLE stdin_read = NULL, stdin_write = NULL;
+            HANDLE stdin_read = NULL;
+            stdin_write = NULL;
             if (!CreatePipe(&stdin_read, &stdin_write, &sa, 0)) {
                 std::cerr << "[CMD] CreatePipe failed: " << GetLastError() << std::endl;
-                return;
+                return false;
             }
             SetHandleInformation(stdin_write, HANDLE_FLAG_INHERIT, 0);
 
             STARTUPINFOA si;
-            PROCESS_INFORMATION pi;
             ZeroMemory(&si, sizeof(si));
             si.cb = sizeof(si);
             si.hStdInput = stdin_read;
@@ -155,23 +565,40 @@ namespace Misskey {
                 NULL, NULL, TRUE, 0, NULL, NULL,
                 &si, &pi
             );
+            CloseHandle(stdin_read);
 
             if (!ok) {
                 std::cerr << "[CMD] Failed to launch '" << config.program
                           << "': error " << GetLastError() << std::endl;
-                CloseHandle(stdin_read);
                 CloseHandle(stdin_write);
-                return;
+                stdin_write = NULL;
+                return false;
             }
+            return true;
+        }
+
+        void exec_command_win32(const std::string& json_payload) {
+            auto started = std::chrono::steady_clock::now();
+            PROCESS_INFORMATION pi;
+            HANDLE stdin_write = NULL;
+            if (!spawn_win32(pi, stdin_write)) return;
+            auto spawned = std::chrono::steady_clock::now();
+            if (metrics) metrics->record(Stage::Spawn, spawned - started);
 
             DWORD written;
-            std::string input = json_payload + "\n";
+            std::string input = json_payload + line_end;
             WriteFile(stdin_write, input.c_str(),
                       static_cast<DWORD>(input.size()), &written, NULL);
             CloseHandle(stdin_write);
-            CloseHandle(stdin_read);
 
-            WaitForSingleObject(pi.hProcess, 10000);
+            bool timed_out = WaitForSingleObject(pi.hProcess, static_cast<DWORD>(config.timeout_ms)) == WAIT_TIMEOUT;
+            if (timed_out) {
+                TerminateProcess(pi.hProcess, 1);
+                std::cerr << "[CMD] '" << config.program
+                          << "' timed out, killed" << std::endl;
+            }
+            record_exec(std::chrono::steady_clock::now() - started, timed_out);
+            if (metrics) metrics->record(Stage::ChildRun, std::chrono::steady_clock::now() - spawned);
 
             DWORD exit_code = 0;
             GetExitCodeProcess(pi.hProcess, &exit_code);
@@ -183,67 +610,154 @@ namespace Misskey {
             CloseHandle(pi.hProcess);
             CloseHandle(pi.hThread);
         }
+
+        bool start_child(Worker& w) {
+            PROCESS_INFORMATION pi;
+            if (!spawn_win32(pi, w.child_stdin)) return false;
+            CloseHandle(pi.hThread);
+            w.child_process = pi.hProcess;
+            w.child_started = std::chrono::steady_clock::now();
+            return true;
+        }
+
+        bool child_alive(Worker& w) {
+            if (!w.child_process) return false;
+            if (WaitForSingleObject(w.child_process, 0) != WAIT_OBJECT_0) return true;
+
+            DWORD exit_code = 0;
+            GetExitCodeProcess(w.child_process, &exit_code);
+            std::cerr << "[CMD] persistent '" << config.program
+                      << "' exited with code " << exit_code << std::endl;
+            stop_persistent(w);
+            return false;
+        }
+
+        // Anonymous pipes are blocking on Windows; a full pipe simply
+        // blocks the worker until the child reads
+        bool write_child(Worker& w, const std::string& input) {
+            DWORD written = 0;
+            return WriteFile(w.child_stdin, input.c_str(),
+                             static_cast<DWORD>(input.size()), &written, NULL) &&
+                   written == input.size();
+        }
+
+        void stop_persistent(Worker& w) {
+            if (w.child_stdin) {
+                CloseHandle(w.child_stdin);
+                w.child_stdin = NULL;
+            }
+            if (w.child_process) {
+                if (WaitForSingleObject(w.child_process, 3000) != WAIT_OBJECT_0) {
+                    TerminateProcess(w.child_process, 1);
+                }
+                CloseHandle(w.child_process);
+                w.child_process = NULL;
+                note_child_exit(w);
+            }
+        }
 #else
-        void exec_command_posix(const std::string& json_payload) {
+        // Fork and exec the configured program with a pipe on its stdin
+        // Returns the child pid (or -1) and the parent's write end in stdin_write.
+        pid_t spawn_posix(int& stdin_write) {
+            // Everything the child needs is built first: between fork() and
+            // exec() only async-signal-safe calls are allowed
+            std::vector<const char*> argv;
+            argv.push_back(config.program.c_str());
+            for (const auto& a : config.args) {
+                argv.push_back(a.c_str());
+            }
+            argv.push_back(nullptr);
+            // Room left for the errno digits and a newline, filled in by the child
+            std::string exec_failed = "[CMD] execvp '" + config.program + "' failed: errno ";
+            size_t exec_failed_len = exec_failed.size();
+            exec_failed.resize(exec_failed_len + 16);
+
+            // Close-on-exec from the start, so a child forked meanwhile by
+            // another worker cannot inherit our pipe ends
             int pipefd[2];
+#ifdef __APPLE__
             if (pipe(pipefd) == -1) {
+#else
+            if (pipe2(pipefd, O_CLOEXEC) == -1) {
+#endif
                 std::cerr << "[CMD] pipe() failed: " << strerror(errno) << std::endl;
-                return;
+                return -1;
             }
+#ifdef __APPLE__
+            // No pipe2 here; the window before these calls remains
+            fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+#endif
 
             pid_t pid = fork();
             if (pid == -1) {
                 std::cerr << "[CMD] fork() failed: " << strerror(errno) << std::endl;
                 close(pipefd[0]);
                 close(pipefd[1]);
-                return;
+                return -1;
             }
 
             if (pid == 0) {
                 // Child process
                 close(pipefd[1]); // close write end
-                dup2(pipefd[0], STDIN_FILENO);
+                dup2(pipefd[0], STDIN_FILENO); // the copy is not close-on-exec
                 close(pipefd[0]);
+                signal(SIGPIPE, SIG_DFL);
 
-                // Build argv
-                std::vector<const char*> argv;
-                argv.push_back(config.program.c_str());
-                for (const auto& a : config.args) {
-                    argv.push_back(a.c_str());
-                }
-                argv.push_back(nullptr);
-
-                execvp(config.program.c_str(),
-                       const_cast<char* const*>(argv.data()));
+                execvp(argv[0], const_cast<char* const*>(argv.data()));
 
                 // If exec fails
-                std::cerr << "[CMD] execvp '" << config.program
-                          << "' failed: " << strerror(errno) << std::endl;
+                int err = errno;
+                char digits[12];
+                int n = 0;
+                do {
+                    digits[n++] = static_cast<char>('0' + err % 10);
+                    err /= 10;
+                } while (err > 0 && n < 12);
+                char* out = exec_failed.data() + exec_failed_len;
+                while (n > 0) *out++ = digits[--n];
+                *out++ = '\n';
+                ssize_t w = write(STDERR_FILENO, exec_failed.data(), static_cast<size_t>(out - exec_failed.data()));
+                (void)w;
                 _exit(127);
             }
 
             // Parent process
             close(pipefd[0]); // close read end
+            stdin_write = pipefd[1];
+            return pid;
+        }
 
-            std::string input = json_payload + "\n";
-            ssize_t w = write(pipefd[1], input.c_str(), input.size());
-            (void)w; // ignore partial writes for simplicity
-            close(pipefd[1]);
+        void exec_command_posix(const std::string& json_payload) {
+            auto started = std::chrono::steady_clock::now();
+            int stdin_write = -1;
+            pid_t pid = spawn_posix(stdin_write);
+            if (pid == -1) return;
+            auto spawned = std::chrono::steady_clock::now();
+            if (metrics) metrics->record(Stage::Spawn, spawned - started);
 
-            // Wait up to 10 seconds
             int status = 0;
-            int wait_ms = 0;
-            while (wait_ms < 10000) {
-                pid_t result = waitpid(pid, &status, WNOHANG);
-                if (result == pid) break;
-                if (result == -1) break;
-                std::this_thread::sleep_for(std::chrono::milliseconds(50));
-                wait_ms += 50;
+            bool timed_out = false;
+#ifdef __linux__
+            if (reaper_ok) {
+                // The reaper feeds stdin, enforces the timeout and tells us
+                // the moment the child exits
+                std::promise<ChildReaper::Result> done;
+                auto fut = done.get_future();
+                reaper.watch(pid, stdin_write, json_payload + line_end, config.timeout_ms, started,
+                             [&done](const ChildReaper::Result& r) { done.set_value(r); });
+                ChildReaper::Result r = fut.get();
+                status = r.status;
+                timed_out = r.timed_out;
+            } else
+#endif
+            {
+                wait_child_polling(pid, stdin_write, json_payload, status, timed_out);
             }
+            record_exec(std::chrono::steady_clock::now() - started, timed_out);
+            if (metrics) metrics->record(Stage::ChildRun, std::chrono::steady_clock::now() - spawned);
 
-            if (wait_ms >= 10000) {
-                kill(pid, SIGKILL);
-                waitpid(pid, &status, 0);
+            if (timed_out) {
                 std::cerr << "[CMD] '" << config.program
                           << "' timed out, killed" << std::endl;
             } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
@@ -251,6 +765,101 @@ namespace Misskey {
                           << "' exited with code " << WEXITSTATUS(status) << std::endl;
             }
         }
+
+        // Fallback without the reaper: write stdin, then poll waitpid
+        void wait_child_polling(pid_t pid, int stdin_write, const std::string& json_payload,
+                                int& status, bool& timed_out) {
+            std::string input = json_payload + line_end;
+            ssize_t w = write(stdin_write, input.c_str(), input.size());
+            (void)w; // ignore partial writes for simplicity
+            close(stdin_write);
+
+            int wait_ms = 0;
+            while (wait_ms < config.timeout_ms) {
+                pid_t result = waitpid(pid, &status, WNOHANG);
+                if (result == pid) return;
+                if (result == -1) return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                wait_ms += 50;
+            }
+
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            timed_out = true;
+        }
+
+        bool start_child(Worker& w) {
+            w.child_pid = spawn_posix(w.child_stdin);
+            if (w.child_pid == -1) return false;
+            fcntl(w.child_stdin, F_SETFL, fcntl(w.child_stdin, F_GETFL) | O_NONBLOCK);
+            w.child_started = std::chrono::steady_clock::now();
+            return true;
+        }
+
+        bool child_alive(Worker& w) {
+            if (w.child_pid == -1) return false;
+            int status = 0;
+            if (waitpid(w.child_pid, &status, WNOHANG) != w.child_pid) return true;
+
+            if (WIFEXITED(status)) {
+                std::cerr << "[CMD] persistent '" << config.program
+                          << "' exited with code " << WEXITSTATUS(status) << std::endl;
+            } else if (WIFSIGNALED(status)) {
+                std::cerr << "[CMD] persistent '" << config.program
+                          << "' killed by signal " << WTERMSIG(status) << std::endl;
+            }
+            w.child_pid = -1;
+            close(w.child_stdin);
+            w.child_stdin = -1;
+            note_child_exit(w);
+            return false;
+        }
+
+        // Write the whole line; when the pipe is full wait for the child to
+        // drain it, up to write_timeout_ms. False if the child is gone or stuck.
+        bool write_child(Worker& w, const std::string& input) {
+            size_t off = 0;
+            while (off < input.size()) {
+                ssize_t n = write(w.child_stdin, input.data() + off, input.size() - off);
+                if (n > 0) {
+                    off += static_cast<size_t>(n);
+                    continue;
+                }
+                if (n == -1 && errno == EINTR) continue;
+                if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    pollfd pfd{w.child_stdin, POLLOUT, 0};
+                    int r = poll(&pfd, 1, write_timeout_ms);
+                    if (r > 0 && !(pfd.revents & (POLLERR | POLLHUP))) continue;
+                    if (r == -1 && errno == EINTR) continue;
+                }
+                return false;
+            }
+            return true;
+        }
+
+        // Close stdin so the child can exit on EOF; kill it if it lingers
+        void stop_persistent(Worker& w) {
+            if (w.child_stdin != -1) {
+                close(w.child_stdin);
+                w.child_stdin = -1;
+            }
+            if (w.child_pid == -1) return;
+
+            int status = 0;
+            for (int waited = 0; waited < 3000; waited += 50) {
+                if (waitpid(w.child_pid, &status, WNOHANG) != 0) {
+                    w.child_pid = -1;
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            if (w.child_pid != -1) {
+                kill(w.child_pid, SIGKILL);
+                waitpid(w.child_pid, &status, 0);
+                w.child_pid = -1;
+            }
+            note_child_exit(w);
+        }
 #endif
 
         static std::string quote_arg(const std::string& arg) {
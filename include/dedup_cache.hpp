@@ -0,0 +1,131 @@
+#ifndef DEDUP_CACHE
+#define DEDUP_CACHE
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <nlohmann/json.hpp>
+#include "lru_map.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    struct DedupConfig {
+        bool enabled = false;
+        size_t capacity = 10000;            // note ids remembered (least recently seen go first)
+        int window_s = 600;                 // a copy older than this counts as new (0 = no limit)
+        std::vector<std::string> prefer;    // event ranking, e.g. {"mention", "notification", "note"}
+        std::string on_duplicate = "drop";  // "drop", or "tag": emit a small output-only "duplicate" event
+        bool merge = false;                 // add "seenAs" (earlier copies) to a preferred copy
+    };
+
+    // Recently seen note ids, to emit each note once across channels
+    // The same note can arrive on a timeline, as a mention and inside a reply
+    // notification. The first copy is emitted; later copies are duplicates
+    // unless their event ranks above every copy emitted so far in `prefer`.
+    class DedupCache {
+    public:
+        DedupConfig config;
+
+        struct Sighting {
+            std::string event;
+            std::string channel;
+        };
+
+        enum class Verdict {
+            First,      // not seen within the window: emit
+            Preferred,  // seen, but this event ranks higher: emit again
+            Duplicate,  // skip
+        };
+
+        // Record one copy of note `id` arriving as `event` on `channel`
+        // `earlier`, if given, receives the copies seen before this one.
+        Verdict check(std::string_view id, std::string_view event, std::string_view channel,
+                      std::vector<Sighting>* earlier = nullptr) {
+            auto now = std::chrono::steady_clock::now();
+            size_t rank = rank_of(event);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if (Entry* e = entries.find(id)) {
+                if (config.window_s <= 0 || now - e->first_seen < std::chrono::seconds(config.window_s)) {
+                    if (earlier) *earlier = e->sightings;
+                    if (e->sightings.size() < max_sightings) e->sightings.push_back({std::string(event), std::string(channel)});
+                    if (rank < e->best_rank) {
+                        e->best_rank = rank;
+                        preferred.fetch_add(1, std::memory_order_relaxed);
+                        return Verdict::Preferred;
+                    }
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return Verdict::Duplicate;
+                }
+                // Too old to be the same delivery: start over
+                reset(*e, now, rank, event, channel);
+                misses.fetch_add(1, std::memory_order_relaxed);
+                return Verdict::First;
+            }
+
+            bool full = false;
+            reset(entries.insert(id, config.capacity, full), now, rank, event, channel);
+            if (full) evicted.fetch_add(1, std::memory_order_relaxed);
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return Verdict::First;
+        }
+
+        json stats() const {
+            size_t size;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                size = entries.size();
+            }
+            return json{
+                {"size", size},
+                {"hits", hits.load()},
+                {"misses", misses.load()},
+                {"preferred", preferred.load()},
+                {"evicted", evicted.load()},
+            };
+        }
+
+        uint64_t total_hits() const { return hits.load(); }
+
+    private:
+        static constexpr size_t max_sightings = 8;
+
+        struct Entry {
+            std::chrono::steady_clock::time_point first_seen;
+            size_t best_rank = 0;               // best-ranked copy emitted so far
+            std::vector<Sighting> sightings;    // first few copies, in arrival order
+        };
+
+        mutable std::mutex mtx;
+        LruMap<Entry> entries;  // by note id
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> preferred{0};
+        std::atomic<uint64_t> evicted{0};
+
+        // Position in `prefer`; unlisted events rank last
+        size_t rank_of(std::string_view event) const {
+            for (size_t i = 0; i < config.prefer.size(); i++) {
+                if (config.prefer[i] == event) return i;
+            }
+            return config.prefer.size();
+        }
+
+        static void reset(Entry& e, std::chrono::steady_clock::time_point now, size_t rank,
+                          std::string_view event, std::string_view channel) {
+            e.first_seen = now;
+            e.best_rank = rank;
+            e.sightings.clear();
+            e.sightings.push_back({std::string(event), std::string(channel)});
+        }
+    };
+
+} // namespace Misskey
+
+#endif // DEDUP_CACHE
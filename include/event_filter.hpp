@@ -0,0 +1,358 @@
+#ifndef EVENT_FILTER
+#define EVENT_FILTER
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <stdexcept>
+#include <cctype>
+#include <functional>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // What a filter looks at for one stream event
+    // `note` and `user` point into the raw streaming message, so the filter
+    // runs before anything is extracted or serialised. `user` defaults to the
+    // note's author.
+    struct FilterContext {
+        std::string_view channel;
+        std::string_view event;
+        const json* note = nullptr;
+        const json* user = nullptr;
+    };
+
+    // Event filter compiled once from an expression such as
+    //
+    //   channel == "global" and not is_renote and host in [null, "misskey.io"]
+    //   event == "note" and (has_files or text contains "#art")
+    //
+    // String fields: channel, event, host, visibility, user_id, text
+    //   compared with ==, !=, in [..] and contains; null means "" (local host)
+    // Bool fields: has_files, is_renote, used bare or with == true/false
+    // Combinators: and, or, not (also &&, ||, !) and parentheses.
+    class EventFilter {
+    public:
+        EventFilter() = default;
+
+        // Throws std::invalid_argument with the position of the error
+        static EventFilter compile(const std::string& expression) {
+            EventFilter f;
+            f.source = expression;
+            if (expression.find_first_not_of(" \t\r\n") == std::string::npos) return f;
+
+            Parser p{expression};
+            f.root = p.parse_or();
+            p.skip_ws();
+            if (p.pos < expression.size()) p.fail("unexpected input");
+            f.active = true;
+            return f;
+        }
+
+        // True when no expression is set (everything passes)
+        bool empty() const { return !active; }
+
+        const std::string& expression() const { return source; }
+
+        bool match(const FilterContext& ctx) const {
+            return !active || eval(root, ctx);
+        }
+
+        // Decide from channel and event alone, before the frame is parsed
+        // Returns false only when no value of the other fields could make the
+        // event pass; true means "maybe", and match() has the final say.
+        bool may_match(std::string_view channel, std::string_view event) const {
+            return !active || partial(root, channel, event) != Tri::False;
+        }
+
+    private:
+        enum class Field { Channel, Event, Host, Visibility, UserId, Text, HasFiles, IsRenote };
+
+        enum class Op { And, Or, Not, Const, Truthy, Eq, Ne, In, Contains };
+
+        // Lets `in` look up a string_view without building a std::string
+        struct StrHash {
+            using is_transparent = void;
+            size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+        };
+        using StrSet = std::unordered_set<std::string, StrHash, std::equal_to<>>;
+
+        struct Node {
+            Op op = Op::Const;
+            Field field = Field::Channel;
+            bool value = true;                 // Const, or the bool compared by Truthy
+            std::string str;                   // Eq / Ne / Contains operand
+            StrSet set;                        // In operand
+            std::vector<Node> kids;
+        };
+
+        bool active = false;
+        std::string source;
+        Node root;
+
+        static bool is_bool_field(Field f) {
+            return f == Field::HasFiles || f == Field::IsRenote;
+        }
+
+        static std::string_view str_at(const json* obj, const char* key) {
+            if (!obj || !obj->is_object()) return {};
+            auto it = obj->find(key);
+            if (it == obj->end() || !it->is_string()) return {};
+            return it->get_ref<const std::string&>();
+        }
+
+        static bool non_null(const json* obj, const char* key) {
+            if (!obj || !obj->is_object()) return false;
+            auto it = obj->find(key);
+            return it != obj->end() && !it->is_null();
+        }
+
+        static const json* author(const FilterContext& ctx) {
+            if (ctx.user) return ctx.user;
+            if (!ctx.note || !ctx.note->is_object()) return nullptr;
+            auto it = ctx.note->find("user");
+            return it != ctx.note->end() && it->is_object() ? &*it : nullptr;
+        }
+
+        static std::string_view get_str(Field f, const FilterContext& ctx) {
+            switch (f) {
+            case Field::Channel: return ctx.channel;
+            case Field::Event: return ctx.event;
+            case Field::Host: return str_at(author(ctx), "host");
+            case Field::Visibility: return str_at(ctx.note, "visibility");
+            case Field::UserId: return str_at(author(ctx), "id");
+            case Field::Text: return str_at(ctx.note, "text");
+            default: return {};
+            }
+        }
+
+        static bool get_bool(Field f, const FilterContext& ctx) {
+            if (f == Field::IsRenote) return non_null(ctx.note, "renoteId");
+            if (!ctx.note || !ctx.note->is_object()) return false;
+            auto it = ctx.note->find("files");
+            if (it != ctx.note->end() && it->is_array() && !it->empty()) return true;
+            it = ctx.note->find("fileIds");
+            return it != ctx.note->end() && it->is_array() && !it->empty();
+        }
+
+        static bool eval(const Node& n, const FilterContext& ctx) {
+            switch (n.op) {
+            case Op::And:
+                for (const auto& k : n.kids) if (!eval(k, ctx)) return false;
+                return true;
+            case Op::Or:
+                for (const auto& k : n.kids) if (eval(k, ctx)) return true;
+                return false;
+            case Op::Not: return !eval(n.kids[0], ctx);
+            case Op::Const: return n.value;
+            case Op::Truthy: return get_bool(n.field, ctx) == n.value;
+            case Op::Eq: return get_str(n.field, ctx) == n.str;
+            case Op::Ne: return get_str(n.field, ctx) != n.str;
+            case Op::In: return n.set.find(get_str(n.field, ctx)) != n.set.end();
+            case Op::Contains: return get_str(n.field, ctx).find(n.str) != std::string_view::npos;
+            }
+            return false;
+        }
+
+        enum class Tri { False, True, Unknown };
+
+        // Kleene three-valued evaluation with only channel/event known
+        static Tri partial(const Node& n, std::string_view channel, std::string_view event) {
+            switch (n.op) {
+            case Op::And: {
+                Tri r = Tri::True;
+                for (const auto& k : n.kids) {
+                    Tri t = partial(k, channel, event);
+                    if (t == Tri::False) return Tri::False;
+                    if (t == Tri::Unknown) r = Tri::Unknown;
+                }
+                return r;
+            }
+            case Op::Or: {
+                Tri r = Tri::False;
+                for (const auto& k : n.kids) {
+                    Tri t = partial(k, channel, event);
+                    if (t == Tri::True) return Tri::True;
+                    if (t == Tri::Unknown) r = Tri::Unknown;
+                }
+                return r;
+            }
+            case Op::Not: {
+                Tri t = partial(n.kids[0], channel, event);
+                if (t == Tri::Unknown) return t;
+                return t == Tri::True ? Tri::False : Tri::True;
+            }
+            case Op::Const:
+                return n.value ? Tri::True : Tri::False;
+            default:
+                if (n.field != Field::Channel && n.field != Field::Event) return Tri::Unknown;
+                return eval(n, {channel, event}) ? Tri::True : Tri::False;
+            }
+        }
+
+        // Recursive-descent parser producing the predicate tree
+        struct Parser {
+            const std::string& src;
+            size_t pos = 0;
+
+            [[noreturn]] void fail(const std::string& what) const {
+                throw std::invalid_argument(what + " at column " + std::to_string(pos + 1));
+            }
+
+            void skip_ws() {
+                while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos]))) pos++;
+            }
+
+            // Consume `tok` if it comes next; words must end at a word boundary
+            bool accept(std::string_view tok) {
+                skip_ws();
+                if (src.compare(pos, tok.size(), tok) != 0) return false;
+                bool word = std::isalpha(static_cast<unsigned char>(tok[0]));
+                size_t end = pos + tok.size();
+                if (word && end < src.size() &&
+                    (std::isalnum(static_cast<unsigned char>(src[end])) || src[end] == '_')) {
+                    return false;
+                }
+                pos = end;
+                return true;
+            }
+
+            void expect(std::string_view tok) {
+                if (!accept(tok)) fail("expected '" + std::string(tok) + "'");
+            }
+
+            std::string identifier() {
+                skip_ws();
+                size_t start = pos;
+                while (pos < src.size() &&
+                       (std::isalnum(static_cast<unsigned char>(src[pos])) || src[pos] == '_')) {
+                    pos++;
+                }
+                if (start == pos) fail("expected a field name");
+                return src.substr(start, pos - start);
+            }
+
+            // A string literal, or null (the empty string)
+            std::string literal() {
+                if (accept("null")) return "";
+                skip_ws();
+                if (pos >= src.size() || src[pos] != '"') fail("expected a string");
+                pos++;
+                std::string out;
+                while (pos < src.size() && src[pos] != '"') {
+                    if (src[pos] == '\\' && pos + 1 < src.size()) pos++;
+                    out += src[pos++];
+                }
+                if (pos >= src.size()) fail("unterminated string");
+                pos++;
+                return out;
+            }
+
+            Node parse_or() {
+                Node first = parse_and();
+                size_t saved = pos;
+                if (!(accept("or") || accept("||"))) return first;
+                pos = saved;
+                Node n;
+                n.op = Op::Or;
+                n.kids.push_back(std::move(first));
+                while (accept("or") || accept("||")) n.kids.push_back(parse_and());
+                return n;
+            }
+
+            Node parse_and() {
+                Node first = parse_unary();
+                size_t saved = pos;
+                if (!(accept("and") || accept("&&"))) return first;
+                pos = saved;
+                Node n;
+                n.op = Op::And;
+                n.kids.push_back(std::move(first));
+                while (accept("and") || accept("&&")) n.kids.push_back(parse_unary());
+                return n;
+            }
+
+            Node parse_unary() {
+                if (accept("not") || accept("!")) {
+                    Node n;
+                    n.op = Op::Not;
+                    n.kids.push_back(parse_unary());
+                    return n;
+                }
+                return parse_primary();
+            }
+
+            Node parse_primary() {
+                if (accept("(")) {
+                    Node n = parse_or();
+                    expect(")");
+                    return n;
+                }
+                Node n;
+                if (accept("true")) return n;
+                if (accept("false")) {
+                    n.value = false;
+                    return n;
+                }
+
+                size_t field_pos = (skip_ws(), pos);
+                std::string name = identifier();
+                if (name == "channel") n.field = Field::Channel;
+                else if (name == "event") n.field = Field::Event;
+                else if (name == "host") n.field = Field::Host;
+                else if (name == "visibility") n.field = Field::Visibility;
+                else if (name == "user_id") n.field = Field::UserId;
+                else if (name == "text") n.field = Field::Text;
+                else if (name == "has_files") n.field = Field::HasFiles;
+                else if (name == "is_renote") n.field = Field::IsRenote;
+                else {
+                    pos = field_pos;
+                    fail("unknown field '" + name + "'");
+                }
+
+                if (is_bool_field(n.field)) {
+                    n.op = Op::Truthy;
+                    bool negate = false;
+                    if (accept("==")) negate = false;
+                    else if (accept("!=")) negate = true;
+                    else return n;
+                    bool rhs;
+                    if (accept("true")) rhs = true;
+                    else if (accept("false")) rhs = false;
+                    else fail("expected true or false");
+                    n.value = rhs != negate;
+                    return n;
+                }
+
+                if (accept("==")) {
+                    n.op = Op::Eq;
+                    n.str = literal();
+                } else if (accept("!=")) {
+                    n.op = Op::Ne;
+                    n.str = literal();
+                } else if (accept("contains")) {
+                    n.op = Op::Contains;
+                    n.str = literal();
+                } else if (accept("in")) {
+                    n.op = Op::In;
+                    expect("[");
+                    if (!accept("]")) {
+                        do {
+                            n.set.insert(literal());
+                        } while (accept(","));
+                        expect("]");
+                    }
+                } else {
+                    fail("expected ==, !=, in or contains after '" + name + "'");
+                }
+                return n;
+            }
+        };
+    };
+
+} // namespace Misskey
+
+#endif // EVENT_FILTER
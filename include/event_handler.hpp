@@ -4,40 +4,91 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <iomanip>
 #include <sstream>
 #include <functional>
+#include <atomic>
+#include <algorithm>
 #include <nlohmann/json.hpp>
 #include "command_executor.hpp"
+#include "event_filter.hpp"
+#include "dedup_cache.hpp"
+#include "user_dictionary.hpp"
+#include "stream_cursor.hpp"
+#include "frame_scan.hpp"
+#include "jsonl_writer.hpp"
+#include "binary_event.hpp"
+#include "output_writer.hpp"
+#include "alloc_stats.hpp"
+#include "metrics.hpp"
 
 using json = nlohmann::json;
 
 namespace Misskey {
 
     enum class OutputFormat {
-        Human,  // Human-readable colored output
-        JSONL,  // One JSON object per line (easy for LLM bots to parse)
+        Human,    // Human-readable colored output
+        JSONL,    // One JSON object per line (easy for LLM bots to parse)
+        MsgPack,  // Length-prefixed MessagePack, same schema as JSONL
+        CBOR,     // Length-prefixed CBOR, same schema as JSONL
     };
 
+    // One serialised event; the buffer is reused per thread and format
+    inline const std::string& encode_event(OutputFormat format, std::string_view event, const json& data,
+                                           std::string_view account = {}) {
+        switch (format) {
+            case OutputFormat::MsgPack: return event_msgpack(event, data, account);
+            case OutputFormat::CBOR: return event_cbor(event, data, account);
+            default: return event_line(event, data, account);
+        }
+    }
+
+    // Account whose events the calling thread is handling
+    // A multi-account stream sets this for the length of each websocket
+    // callback (each connection has its own thread); events emitted meanwhile
+    // are tagged with it. Empty outside a scope, so single-account output is
+    // unchanged. The connection's StreamCursor, if any, rides along.
+    class AccountScope {
+    public:
+        explicit AccountScope(const std::string& name, StreamCursor* cursor = nullptr)
+            : prev(current), prev_cursor(current_cursor) {
+            current = &name;
+            current_cursor = cursor;
+        }
+        ~AccountScope() {
+            current = prev;
+            current_cursor = prev_cursor;
+        }
+
+        AccountScope(const AccountScope&) = delete;
+        AccountScope& operator=(const AccountScope&) = delete;
+
+        static const std::string& name() {
+            static const std::string none;
+            return current ? *current : none;
+        }
+
+        static StreamCursor* cursor() {
+            return current_cursor;
+        }
+
+    private:
+        inline static thread_local const std::string* current = nullptr;
+        inline static thread_local StreamCursor* current_cursor = nullptr;
+        const std::string* prev;
+        StreamCursor* prev_cursor;
+    };
+
+    // Records are separated by newlines in the text formats and only by
+    // their length prefix in the binary ones
+    inline const char* record_end(OutputFormat format) {
+        return format == OutputFormat::MsgPack || format == OutputFormat::CBOR ? "" : "\n";
+    }
+
     // Get current ISO8601 timestamp
     inline std::string now_iso8601() {
-        auto now = std::chrono::system_clock::now();
-        auto time_t_now = std::chrono::system_clock::to_time_t(now);
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            now.time_since_epoch()) % 1000;
-
-        std::tm tm_buf;
-#ifdef _WIN32
-        localtime_s(&tm_buf, &time_t_now);
-#else
-        localtime_r(&time_t_now, &tm_buf);
-#endif
-
-        std::ostringstream oss;
-        oss << std::put_time(&tm_buf, "%Y-%m-%dT%H:%M:%S");
-        oss << '.' << std::setfill('0') << std::setw(3) << ms.count();
-        oss << std::put_time(&tm_buf, "%z");
-        return oss.str();
+        std::string ts;
+        append_timestamp(ts);
+        return ts;
     }
 
     // Truncate text for display
@@ -129,37 +180,234 @@ namespace Misskey {
         return n;
     }
 
+    // Extract compact notification info (the "notification" event's data)
+    inline json extract_notification(const json& notif) {
+        json n;
+        n["notificationType"] = notif.value("type", "");
+        n["id"] = notif.value("id", "");
+        if (notif.contains("user") && !notif["user"].is_null()) n["user"] = extract_user(notif["user"]);
+        if (notif.contains("note") && !notif["note"].is_null()) n["note"] = extract_note(notif["note"]);
+        if (notif.contains("reaction")) n["reaction"] = notif["reaction"];
+        return n;
+    }
+
+    // String field or "" when missing or null (text and cw are often null)
+    inline std::string str_or_empty(const json& obj, const char* key) {
+        auto it = obj.find(key);
+        return it != obj.end() && it->is_string() ? it->get<std::string>() : std::string();
+    }
+
+    // One human-readable log line for an event
+    inline std::string format_human(const std::string& event, const json& data,
+                                    const std::string& ts = now_iso8601(),
+                                    const std::string& account = "") {
+        std::ostringstream oss;
+        oss << "[" << ts << "] ";
+        if (!account.empty()) oss << "(" << account << ") ";
+
+        if (event == "note") {
+            std::string user = user_handle(data.at("note").at("user"));
+            std::string channel = data.value("channel", "?");
+            std::string text = str_or_empty(data["note"], "text");
+            bool is_renote = data["note"].contains("renote");
+            std::string cw = str_or_empty(data["note"], "cw");
+
+            oss << "[" << channel << "] " << user;
+            if (is_renote && text.empty()) {
+                std::string rt_user = user_handle(data["note"]["renote"]["user"]);
+                oss << " RN " << rt_user << ": "
+                    << oneline(truncate(str_or_empty(data["note"]["renote"], "text")));
+            } else {
+                if (!cw.empty()) oss << " [CW: " << oneline(cw) << "]";
+                oss << ": " << oneline(truncate(text));
+            }
+
+        } else if (event == "notification") {
+            std::string ntype = data.value("notificationType", "");
+            oss << "[NOTIF:" << ntype << "]";
+            if (data.contains("user")) {
+                oss << " from " << user_handle(data["user"]);
+            }
+            if (data.contains("reaction")) {
+                oss << " " << data["reaction"].get<std::string>();
+            }
+            if (data.contains("note") && data["note"].contains("text")) {
+                oss << " on \"" << oneline(truncate(str_or_empty(data["note"], "text"), 80)) << "\"";
+            }
+
+        } else if (event == "followed") {
+            oss << "[FOLLOWED] by " << user_handle(data["user"]);
+
+        } else if (event == "mention") {
+            std::string user = user_handle(data.at("note").at("user"));
+            oss << "[MENTION] " << user << ": "
+                << oneline(truncate(str_or_empty(data["note"], "text")));
+
+        } else if (event == "connected") {
+            oss << "[SYSTEM] Connected to " << data.value("uri", "");
+
+        } else if (event == "disconnected") {
+            oss << "[SYSTEM] Disconnected: " << data.value("reason", "");
+
+        } else if (event == "reconnecting") {
+            oss << "[SYSTEM] Reconnecting...";
+
+        } else if (event == "dropped") {
+            oss << "[SYSTEM] Command queue full: " << data.value("dropped", 0) << " dropped, "
+                << data.value("spilled", 0) << " spilled (" << data.value("policy", "") << ")";
+
+        } else if (event == "shutdown") {
+            const json& cmd = data.contains("command") ? data["command"] : json::object();
+            oss << "[SYSTEM] Shutting down (" << data.value("reason", "") << ") after "
+                << data.value("uptimeS", 0) << "s: " << cmd.value("drained", 0) << " commands drained, "
+                << cmd.value("spilled", 0) << " spilled, " << cmd.value("dropped", 0) << " dropped";
+
+        } else if (event == "duplicate") {
+            oss << "[DUP] " << data.value("noteId", "") << " again as " << data.value("event", "")
+                << " on " << data.value("channel", "") << " (first " << data.value("firstEvent", "")
+                << " on " << data.value("firstChannel", "") << ")";
+
+        } else if (event == "error") {
+            oss << "[ERROR] " << data.value("code", "") << ": " << data.value("detail", "");
+
+        } else {
+            oss << "[" << event << "] " << data.dump();
+        }
+
+        return oss.str();
+    }
+
     class EventHandler {
     public:
         OutputFormat format = OutputFormat::JSONL;
+        OutputFormat command_format = OutputFormat::JSONL; // payload written to the command
+        Metrics metrics;
         CommandExecutor command;
+        OutputWriter output;      // stdout lines go through this writer thread
+        EventFilter filter;       // stream events failing this are neither emitted nor forwarded
+        DedupCache dedup;         // notes already emitted from another channel
+        bool compact = false;     // not Human: send each user once as a "user" event, then only userId
+        UserDictionary users;     // users already sent in compact mode
+        int stats_interval_s = 0; // emit a "stats" event this often (0 = never)
+
+        EventHandler() {
+            command.metrics = &metrics;
+        }
+
+        EventHandler(const EventHandler&) = delete;
+        EventHandler& operator=(const EventHandler&) = delete;
 
         void start() {
+            output.line_end = record_end(format);
+            command.line_end = record_end(command_format);
+            output.start();
             command.start();
+            started = last_stats = std::chrono::steady_clock::now();
+        }
+
+        // Final stop, once the connections are closed: drain the command
+        // queue ([Command] shutdown_timeout_ms), print a "shutdown" summary
+        // and flush the output
+        void shutdown(const std::string& reason) {
+            json data;
+            data["reason"] = reason;
+            data["uptimeS"] = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now() - started).count();
+            data["command"] = command.drain(std::chrono::milliseconds(command.config.shutdown_timeout_ms));
+            data["stats"] = stats();
+            emit_output_only("shutdown", data);
+            output.stop();
+        }
+
+        // How long the main loop may sleep before tick() has work; -1 = forever
+        std::chrono::milliseconds tick_interval() const {
+            if (stats_interval_s <= 0) return std::chrono::milliseconds(-1);
+            auto due = last_stats + std::chrono::seconds(stats_interval_s) - std::chrono::steady_clock::now();
+            return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(due) + std::chrono::milliseconds(1),
+                            std::chrono::milliseconds(0));
+        }
+
+        // Periodic work; call every so often from the connection loop
+        void tick() {
+            if (stats_interval_s <= 0) return;
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_stats < std::chrono::seconds(stats_interval_s)) return;
+            last_stats = now;
+            emit_output_only("stats", stats());
+        }
+
+        // Everything we measure, as one JSON object
+        json stats() const {
+            json j = metrics.to_json();
+            j["prefilter"] = frame_stats();
+            j["output"] = output.stats();
+            j["command"] = command.stats();
+            if (dedup.config.enabled) j["dedup"] = dedup.stats();
+            if (compact) j["users"] = users.stats();
+            return j;
+        }
+
+        // Prometheus text exposition of stats()
+        std::string prometheus() const {
+            std::string out = metrics.prometheus();
+            json cmd = command.stats();
+            json out_stats = output.stats();
+            Metrics::prom_counter(out, "what_frames_rejected_total", frames_rejected.load());
+            Metrics::prom_counter(out, "what_frames_parsed_total", frames_parsed.load());
+            Metrics::prom_counter(out, "what_command_dropped_total", cmd["queue"].value("dropped", uint64_t(0)));
+            Metrics::prom_counter(out, "what_command_spilled_total", cmd["queue"].value("spilled", uint64_t(0)));
+            Metrics::prom_counter(out, "what_output_dropped_total", out_stats.value("dropped", uint64_t(0)));
+            Metrics::prom_counter(out, "what_output_bytes_total", out_stats.value("bytes", uint64_t(0)));
+            Metrics::prom_counter(out, "what_dedup_hits_total", dedup.total_hits());
+            out += "# TYPE what_command_queued gauge\n";
+            uint64_t queued = 0;
+            for (const auto& w : cmd["workers"]) queued += w.value("queued", uint64_t(0));
+            Metrics::prom_line(out, "what_command_queued", "", static_cast<double>(queued));
+            out += "# TYPE what_output_queued gauge\n";
+            Metrics::prom_line(out, "what_output_queued", "", out_stats.value("queued", 0.0));
+            return out;
         }
 
         // Process a raw streaming message from Misskey
-        void handle(const std::string& raw) {
+        void handle(std::string_view raw) {
+            StageTimer receive(&metrics, Stage::Receive);
+            metrics.frames.fetch_add(1, std::memory_order_relaxed);
+            metrics.bytes_received.fetch_add(raw.size(), std::memory_order_relaxed);
+
             json msg;
-            try {
-                msg = json::parse(raw);
-            } catch (const json::parse_error& e) {
-                emit_error("json_parse_error", e.what());
-                return;
+            {
+                StageTimer parse(&metrics, Stage::Parse);
+                // Cheap head scan first: frames the filter can never accept are
+                // dropped before a DOM is built
+                if (!filter.empty() && prefilter_rejects(raw)) {
+                    frames_rejected.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                frames_parsed.fetch_add(1, std::memory_order_relaxed);
+
+                try {
+                    msg = json::parse(raw);
+                } catch (const json::parse_error& e) {
+                    emit_error("json_parse_error", e.what());
+                    return;
+                }
             }
 
             std::string type = msg.value("type", "");
 
             if (type == "channel") {
                 handle_channel(msg);
-            } else {
+            } else if (filter.match({"", "unknown"})) {
                 // Unknown top-level event
                 emit_event("unknown", {{"rawType", type}});
             }
         }
 
         // System events the caller can emit directly
-        void emit_connected(const std::string& uri) {
+        // `reconnect`: this connection was open before (one per account)
+        void emit_connected(const std::string& uri, bool reconnect = false) {
+            metrics.connects++;
+            if (reconnect) metrics.reconnected++;
             emit_event("connected", {{"uri", uri}});
         }
 
@@ -175,18 +423,127 @@ namespace Misskey {
             emit_event("reconnecting", {});
         }
 
+        // Frames dropped by the prefilter vs. fully parsed
+        json frame_stats() const {
+            json j{{"rejected", frames_rejected.load()}, {"parsed", frames_parsed.load()}};
+#ifdef MISSKEY_ALLOC_STATS
+            // Heap allocations while serialising, writing and queueing one event
+            uint64_t events = emit_events.load();
+            j["emitAllocs"] = {
+                {"events", events},
+                {"total", emit_allocs.load()},
+                {"perEvent", events ? static_cast<double>(emit_allocs.load()) / events : 0.0},
+                {"max", emit_allocs_max.load()},
+            };
+#endif
+            return j;
+        }
+
     private:
+        std::atomic<uint64_t> frames_rejected{0};
+        std::atomic<uint64_t> frames_parsed{0};
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point last_stats;
+#ifdef MISSKEY_ALLOC_STATS
+        std::atomic<uint64_t> emit_events{0};
+        std::atomic<uint64_t> emit_allocs{0};
+        std::atomic<uint64_t> emit_allocs_max{0};
+#endif
+
+        static bool is_timeline_channel(std::string_view channel) {
+            return channel == "social" || channel == "hybridTimeline" ||
+                   channel == "local" || channel == "global" || channel == "home";
+        }
+
+        // True when the frame's channel and event alone rule it out
+        // The names mirror handle_channel; where the emitted event depends on
+        // the body (e.g. "note" vs "timeline_event"), both must be ruled out.
+        bool prefilter_rejects(std::string_view raw) const {
+            FrameHead head;
+            if (!scan_frame_head(raw, head)) return false;
+
+            if (head.type != "channel") return !filter.may_match("", "unknown");
+
+            std::string_view ch = head.channel, ev = head.event;
+            if (is_timeline_channel(ch)) {
+                if (ev == "note") {
+                    return !filter.may_match(ch, "note") && !filter.may_match(ch, "timeline_event");
+                }
+                return !filter.may_match(ch, "timeline_event");
+            }
+            if (ch == "main") {
+                if (ev == "notification" || ev == "followed" || ev == "mention") {
+                    return !filter.may_match(ch, ev) && !filter.may_match(ch, "main_event");
+                }
+                if (ev == "unreadNotification") return !filter.may_match(ch, ev);
+                return !filter.may_match(ch, "main_event");
+            }
+            return !filter.may_match(ch, "channel_event");
+        }
+
+        // Duplicate check for a note about to be extracted; true to skip it
+        // With merge on, a preferred copy gets the earlier copies in `seen_as`.
+        bool dedup_skips(const json& note, const char* event, const std::string& channel, json& seen_as) {
+            if (!dedup.config.enabled) return false;
+            auto id = note.find("id");
+            if (id == note.end() || !id->is_string()) return false;
+
+            const std::string& note_id = id->get_ref<const std::string&>();
+            // Each account gets its own copy of a note
+            const std::string& account = AccountScope::name();
+            std::string scoped_id;
+            if (!account.empty()) scoped_id = account + ":" + note_id;
+            bool want_earlier = dedup.config.merge || dedup.config.on_duplicate == "tag";
+            std::vector<DedupCache::Sighting> earlier;
+            auto verdict = dedup.check(account.empty() ? note_id : scoped_id, event, channel,
+                                       want_earlier ? &earlier : nullptr);
+            if (verdict == DedupCache::Verdict::First) return false;
+
+            if (verdict == DedupCache::Verdict::Preferred) {
+                if (dedup.config.merge) {
+                    seen_as = json::array();
+                    for (const auto& s : earlier) seen_as.push_back({{"event", s.event}, {"channel", s.channel}});
+                }
+                return false;
+            }
+
+            if (dedup.config.on_duplicate == "tag") {
+                json data;
+                data["noteId"] = note_id;
+                data["event"] = event;
+                data["channel"] = channel;
+                if (!earlier.empty()) {
+                    data["firstEvent"] = earlier.front().event;
+                    data["firstChannel"] = earlier.front().channel;
+                }
+                data["copies"] = earlier.size() + 1;
+                emit_output_only("duplicate", data);
+            }
+            return true;
+        }
+
+        // Report an event to the connection's cursor; true to skip it as a
+        // live copy of a backfilled one. Backfilled events get "backfilled".
+        // Runs before the filter and dedup checks.
+        static bool cursor_skips(const std::string& channel, const json& item, json& payload) {
+            StreamCursor* cursor = AccountScope::cursor();
+            if (!cursor) return false;
+            if (!cursor->admit(channel, item.value("id", ""))) return true;
+            json tag = cursor->tag();
+            if (!tag.is_null()) payload["backfilled"] = std::move(tag);
+            return false;
+        }
+
         void handle_channel(const json& msg) {
             const auto& body = msg.at("body");
             std::string channel = body.value("id", "");
             std::string event_type = body.value("type", "");
 
-            if (channel == "social" || channel == "hybridTimeline" ||
-                channel == "local" || channel == "global" || channel == "home") {
+            if (is_timeline_channel(channel)) {
                 handle_timeline_event(channel, event_type, body);
             } else if (channel == "main") {
                 handle_main_event(event_type, body);
-            } else {
+            } else if (filter.match({channel, "channel_event"})) {
                 emit_event("channel_event", {
                     {"channel", channel},
                     {"eventType", event_type}
@@ -199,11 +556,21 @@ namespace Misskey {
                                    const json& body) {
             if (event_type == "note" && body.contains("body")) {
                 const auto& note = body.at("body");
+                // The cursor sees every note, so filtered ones still advance
+                // the next sinceId and a backfilled copy is skipped quietly
                 json payload;
-                payload["channel"] = channel;
-                payload["note"] = extract_note(note);
+                if (cursor_skips(channel, note, payload)) return;
+                if (!filter.match({channel, "note", &note})) return;
+                json seen_as;
+                if (dedup_skips(note, "note", channel, seen_as)) return;
+                {
+                    StageTimer t(&metrics, Stage::Extract);
+                    payload["channel"] = channel;
+                    payload["note"] = extract_note(note);
+                    if (!seen_as.is_null()) payload["seenAs"] = std::move(seen_as);
+                }
                 emit_event("note", payload);
-            } else {
+            } else if (filter.match({channel, "timeline_event"})) {
                 emit_event("timeline_event", {
                     {"channel", channel},
                     {"eventType", event_type}
@@ -214,120 +581,157 @@ namespace Misskey {
         void handle_main_event(const std::string& event_type, const json& body) {
             if (event_type == "notification" && body.contains("body")) {
                 const auto& notif = body.at("body");
-                json payload;
-                payload["notificationType"] = notif.value("type", "");
-                payload["id"] = notif.value("id", "");
-
-                if (notif.contains("user") && !notif["user"].is_null()) {
-                    payload["user"] = extract_user(notif["user"]);
-                }
-                if (notif.contains("note") && !notif["note"].is_null()) {
-                    payload["note"] = extract_note(notif["note"]);
+                const json* note = notif.contains("note") && !notif["note"].is_null() ? &notif["note"] : nullptr;
+                const json* user = notif.contains("user") && !notif["user"].is_null() ? &notif["user"] : nullptr;
+                json tags;
+                if (cursor_skips("main", notif, tags)) return;
+                if (!filter.match({"main", "notification", note, user})) return;
+                // Replies and mentions carry a note that may arrive elsewhere too;
+                // reactions and the like are about our own note and always pass
+                json seen_as;
+                std::string notif_type = notif.value("type", "");
+                if (note && (notif_type == "reply" || notif_type == "mention" || notif_type == "quote") &&
+                    dedup_skips(*note, "notification", "main", seen_as)) {
+                    return;
                 }
-                if (notif.contains("reaction")) {
-                    payload["reaction"] = notif["reaction"];
+                json payload;
+                {
+                    StageTimer t(&metrics, Stage::Extract);
+                    payload = extract_notification(notif);
+                    if (!seen_as.is_null()) payload["seenAs"] = std::move(seen_as);
+                    if (tags.contains("backfilled")) payload["backfilled"] = std::move(tags["backfilled"]);
                 }
 
                 emit_event("notification", payload);
 
             } else if (event_type == "followed" && body.contains("body")) {
+                if (!filter.match({"main", "followed", nullptr, &body.at("body")})) return;
                 json payload;
-                payload["user"] = extract_user(body.at("body"));
+                {
+                    StageTimer t(&metrics, Stage::Extract);
+                    payload["user"] = extract_user(body.at("body"));
+                }
                 emit_event("followed", payload);
 
             } else if (event_type == "mention" && body.contains("body")) {
+                if (!filter.match({"main", "mention", &body.at("body")})) return;
+                json seen_as;
+                if (dedup_skips(body.at("body"), "mention", "main", seen_as)) return;
                 json payload;
-                payload["note"] = extract_note(body.at("body"));
+                {
+                    StageTimer t(&metrics, Stage::Extract);
+                    payload["note"] = extract_note(body.at("body"));
+                    if (!seen_as.is_null()) payload["seenAs"] = std::move(seen_as);
+                }
                 emit_event("mention", payload);
 
             } else if (event_type == "unreadNotification") {
-                emit_event("unreadNotification", {});
+                if (filter.match({"main", "unreadNotification"})) emit_event("unreadNotification", {});
 
-            } else {
+            } else if (filter.match({"main", "main_event"})) {
                 emit_event("main_event", {{"eventType", event_type}});
             }
         }
 
         // Core emit function
+        // The event is serialised once and the same bytes go to stdout and
+        // to the command queue when both use the same machine format.
         void emit_event(const std::string& event, const json& data) {
-            if (format == OutputFormat::JSONL) {
-                emit_jsonl(event, data);
-            } else {
-                emit_human(event, data);
-            }
-
-            // Forward to external command if configured
-            command.send(event, data);
-        }
-
-        void emit_jsonl(const std::string& event, const json& data) {
-            json line;
-            line["ts"] = now_iso8601();
-            line["event"] = event;
-            line["data"] = data;
-            std::cout << line.dump(-1, ' ', false, json::error_handler_t::replace) << std::endl;
-        }
-
-        void emit_human(const std::string& event, const json& data) {
-            std::string ts = now_iso8601();
-            std::ostringstream oss;
-            oss << "[" << ts << "] ";
-
-            if (event == "note") {
-                std::string user = user_handle(data.at("note").at("user"));
-                std::string channel = data.value("channel", "?");
-                std::string text = data["note"].value("text", "");
-                bool is_renote = data["note"].contains("renote");
-                std::string cw = data["note"].value("cw", "");
-
-                oss << "[" << channel << "] " << user;
-                if (is_renote && text.empty()) {
-                    std::string rt_user = user_handle(data["note"]["renote"]["user"]);
-                    oss << " RN " << rt_user << ": "
-                        << oneline(truncate(data["note"]["renote"].value("text", "")));
+#ifdef MISSKEY_ALLOC_STATS
+            uint64_t allocs_before = alloc_count();
+#endif
+            metrics.count_event(event);
+            const std::string& account = AccountScope::name();
+            const std::string* line = nullptr;
+            {
+                StageTimer t(&metrics, Stage::Emit);
+                if (format == OutputFormat::Human) {
+                    emit_human(event, data);
+                } else if (compact) {
+                    // The command still gets the full event below
+                    json slim = data;
+                    compact_users(slim);
+                    write_line(encode_event(format, event, slim, account));
                 } else {
-                    if (!cw.empty()) oss << " [CW: " << oneline(cw) << "]";
-                    oss << ": " << oneline(truncate(text));
-                }
-
-            } else if (event == "notification") {
-                std::string ntype = data.value("notificationType", "");
-                oss << "[NOTIF:" << ntype << "]";
-                if (data.contains("user")) {
-                    oss << " from " << user_handle(data["user"]);
-                }
-                if (data.contains("reaction")) {
-                    oss << " " << data["reaction"].get<std::string>();
-                }
-                if (data.contains("note") && data["note"].contains("text")) {
-                    oss << " on \"" << oneline(truncate(data["note"].value("text", ""), 80)) << "\"";
+                    line = &encode_event(format, event, data, account);
+                    write_line(*line);
                 }
+            }
 
-            } else if (event == "followed") {
-                oss << "[FOLLOWED] by " << user_handle(data["user"]);
+            // Forward to external command if configured
+            if (command.wants(event)) {
+                StageTimer t(&metrics, Stage::Enqueue);
+                if (!line || command_format != format) line = &encode_event(command_format, event, data, account);
+                command.send_line(event, data, *line);
+            }
+#ifdef MISSKEY_ALLOC_STATS
+            uint64_t allocs = alloc_count() - allocs_before;
+            emit_events.fetch_add(1, std::memory_order_relaxed);
+            emit_allocs.fetch_add(allocs, std::memory_order_relaxed);
+            if (allocs > emit_allocs_max.load(std::memory_order_relaxed)) emit_allocs_max = allocs;
+#endif
+            report_overflow();
+        }
 
-            } else if (event == "mention") {
-                std::string user = user_handle(data.at("note").at("user"));
-                oss << "[MENTION] " << user << ": "
-                    << oneline(truncate(data["note"].value("text", "")));
+        bool write_line(const std::string& line) {
+            return output.push(line);
+        }
 
-            } else if (event == "connected") {
-                oss << "[SYSTEM] Connected to " << data.value("uri", "");
+        // Compact mode: drop embedded users, leaving their id
+        // Users not yet sent (or changed since) go out first as "user" events;
+        // one whose "user" line the output policy discarded stays embedded.
+        void compact_users(json& data) {
+            auto user = data.find("user");
+            if (user != data.end() && user->is_object() && announce_user(*user)) {
+                data["userId"] = user->value("id", "");
+                data.erase("user");
+            }
+            auto note = data.find("note");
+            if (note != data.end() && note->is_object()) compact_note(*note);
+        }
 
-            } else if (event == "disconnected") {
-                oss << "[SYSTEM] Disconnected: " << data.value("reason", "");
+        void compact_note(json& note) {
+            auto user = note.find("user");
+            if (user != note.end() && user->is_object() && announce_user(*user)) {
+                note.erase(user); // extract_note already sets userId
+            }
+            for (const char* key : {"reply", "renote"}) {
+                auto inner = note.find(key);
+                if (inner != note.end() && inner->is_object()) compact_note(*inner);
+            }
+        }
 
-            } else if (event == "reconnecting") {
-                oss << "[SYSTEM] Reconnecting...";
+        // True once the consumer has `user`: sent before, or queued now
+        bool announce_user(const json& user) {
+            uint64_t fp = 0;
+            if (!users.needs_send(user, fp)) return user.contains("id") && user["id"].is_string();
+            if (!emit_output_only("user", user)) return false;
+            users.sent(user, fp);
+            return true;
+        }
 
-            } else if (event == "error") {
-                oss << "[ERROR] " << data.value("code", "") << ": " << data.value("detail", "");
+        // Tell the consumer when the command queue lost events (output only;
+        // the command never sees these)
+        void report_overflow() {
+            uint64_t dropped = 0, spilled = 0;
+            if (!command.take_overflow_report(dropped, spilled)) return;
+            json data;
+            data["dropped"] = dropped;
+            data["spilled"] = spilled;
+            data["totalDropped"] = command.total_dropped();
+            data["totalSpilled"] = command.total_spilled();
+            data["policy"] = command.config.overflow;
+            emit_output_only("dropped", data);
+        }
 
-            } else {
-                oss << "[" << event << "] " << data.dump();
-            }
+        // Write an event to the output without forwarding it to the command
+        bool emit_output_only(const std::string& event, const json& data) {
+            if (format == OutputFormat::Human) return emit_human(event, data);
+            return write_line(encode_event(format, event, data, AccountScope::name()));
+        }
 
-            std::cout << oss.str() << std::endl;
+        bool emit_human(const std::string& event, const json& data) {
+            return output.push(format_human(event, data, now_iso8601(), AccountScope::name()));
         }
     };
 
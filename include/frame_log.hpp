@@ -0,0 +1,243 @@
+#ifndef FRAME_LOG
+#define FRAME_LOG
+
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Misskey {
+
+    // Recorded stream frames
+    //
+    // File layout: the 8-byte magic "WHATREC1", then one record per frame:
+    //   u32 length (little endian) | u64 receive time, us since epoch | frame bytes
+    // Files are append-only, so a crash loses at most the last record. With
+    // compression the same byte stream is gzip'd; gzip members concatenate,
+    // so compressed files can be appended to as well.
+    inline constexpr char frame_log_magic[8] = {'W', 'H', 'A', 'T', 'R', 'E', 'C', '1'};
+
+    namespace detail {
+        inline void put_le(char* out, uint64_t v, int bytes) {
+            for (int i = 0; i < bytes; i++) out[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+        }
+
+        inline uint64_t get_le(const char* in, int bytes) {
+            uint64_t v = 0;
+            for (int i = 0; i < bytes; i++) v |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+            return v;
+        }
+    }
+
+    class FrameLogWriter {
+    public:
+        FrameLogWriter() = default;
+
+        ~FrameLogWriter() {
+            close();
+        }
+
+        FrameLogWriter(const FrameLogWriter&) = delete;
+        FrameLogWriter& operator=(const FrameLogWriter&) = delete;
+
+        bool open(const std::string& path, bool gzip) {
+            bool fresh = true;
+            {
+                std::ifstream existing(path, std::ios::binary | std::ios::ate);
+                if (existing && existing.tellg() > 0) fresh = false;
+            }
+            if (gzip) {
+                gz = gzopen(path.c_str(), "ab");
+                if (!gz) return fail(path);
+            } else {
+                file = std::fopen(path.c_str(), "ab");
+                if (!file) return fail(path);
+            }
+            if (fresh) write_raw(frame_log_magic, sizeof(frame_log_magic));
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (gz) gzclose(gz);
+            if (file) std::fclose(file);
+            gz = nullptr;
+            file = nullptr;
+        }
+
+        // Append one frame stamped with the current time
+        void write(std::string_view frame) {
+            auto now = std::chrono::system_clock::now();
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+            char head[12];
+            detail::put_le(head, frame.size(), 4);
+            detail::put_le(head + 4, static_cast<uint64_t>(us), 8);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            write_raw(head, sizeof(head));
+            write_raw(frame.data(), frame.size());
+            frames++;
+
+            // Make records visible to readers about once a second
+            auto steady = std::chrono::steady_clock::now();
+            if (steady - last_flush >= std::chrono::seconds(1)) {
+                if (gz) gzflush(gz, Z_SYNC_FLUSH);
+                if (file) std::fflush(file);
+                last_flush = steady;
+            }
+        }
+
+        uint64_t count() const { return frames; }
+
+    private:
+        std::mutex mtx;
+        gzFile gz = nullptr;
+        std::FILE* file = nullptr;
+        uint64_t frames = 0;
+        std::chrono::steady_clock::time_point last_flush;
+
+        bool fail(const std::string& path) {
+            std::cerr << "[REC] cannot open " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        void write_raw(const char* data, size_t size) {
+            if (gz) gzwrite(gz, data, static_cast<unsigned>(size));
+            if (file) std::fwrite(data, 1, size, file);
+        }
+    };
+
+    // Reads a recording back frame by frame
+    // Plain files are mapped into memory and frames are returned as views
+    // into the mapping; gzip'd files are inflated into memory first.
+    class FrameLogReader {
+    public:
+        FrameLogReader() = default;
+
+        ~FrameLogReader() {
+#ifndef _WIN32
+            if (map) munmap(map, map_size);
+#endif
+        }
+
+        FrameLogReader(const FrameLogReader&) = delete;
+        FrameLogReader& operator=(const FrameLogReader&) = delete;
+
+        bool open(const std::string& path) {
+            if (is_gzip(path)) {
+                if (!inflate_file(path)) return false;
+            } else if (!map_file(path)) {
+                return false;
+            }
+            if (size < sizeof(frame_log_magic) || std::memcmp(data, frame_log_magic, sizeof(frame_log_magic)) != 0) {
+                std::cerr << "[REC] " << path << " is not a recording" << std::endl;
+                return false;
+            }
+            pos = sizeof(frame_log_magic);
+            return true;
+        }
+
+        // Next frame and its receive time (us since epoch); false at the end
+        // A truncated last record is treated as the end.
+        bool next(std::string_view& frame, uint64_t& time_us) {
+            // Recordings appended to later repeat the magic; skip it
+            if (size - pos >= sizeof(frame_log_magic) &&
+                std::memcmp(data + pos, frame_log_magic, sizeof(frame_log_magic)) == 0) {
+                pos += sizeof(frame_log_magic);
+            }
+            if (size - pos < 12) return false;
+            uint64_t len = detail::get_le(data + pos, 4);
+            time_us = detail::get_le(data + pos + 4, 8);
+            if (size - pos - 12 < len) return false;
+            frame = std::string_view(data + pos + 12, static_cast<size_t>(len));
+            pos += 12 + static_cast<size_t>(len);
+            return true;
+        }
+
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+        size_t pos = 0;
+        std::string inflated;
+        void* map = nullptr;
+        size_t map_size = 0;
+
+        static bool is_gzip(const std::string& path) {
+            std::ifstream in(path, std::ios::binary);
+            unsigned char magic[2] = {0, 0};
+            in.read(reinterpret_cast<char*>(magic), 2);
+            return in && magic[0] == 0x1f && magic[1] == 0x8b;
+        }
+
+        bool inflate_file(const std::string& path) {
+            gzFile gz = gzopen(path.c_str(), "rb");
+            if (!gz) {
+                std::cerr << "[REC] cannot open " << path << std::endl;
+                return false;
+            }
+            gzbuffer(gz, 1 << 16);
+            char buf[1 << 16];
+            int n;
+            while ((n = gzread(gz, buf, sizeof(buf))) > 0) inflated.append(buf, static_cast<size_t>(n));
+            gzclose(gz);
+            data = inflated.data();
+            size = inflated.size();
+            return true;
+        }
+
+        bool map_file(const std::string& path) {
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                std::cerr << "[REC] cannot open " << path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                ::close(fd);
+                std::cerr << "[REC] " << path << " is empty" << std::endl;
+                return false;
+            }
+            map_size = static_cast<size_t>(st.st_size);
+            map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                map = nullptr;
+                std::cerr << "[REC] mmap " << path << " failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            madvise(map, map_size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(map);
+            size = map_size;
+            return true;
+#else
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                std::cerr << "[REC] cannot open " << path << std::endl;
+                return false;
+            }
+            inflated.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data = inflated.data();
+            size = inflated.size();
+            return true;
+#endif
+        }
+    };
+
+} // namespace Misskey
+
+#endif // FRAME_LOG
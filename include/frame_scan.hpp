@@ -0,0 +1,159 @@
+#ifndef FRAME_SCAN
+#define FRAME_SCAN
+
+#include <string_view>
+#include <cstring>
+
+namespace Misskey {
+
+    // Routing fields of a streaming frame, read without building a DOM
+    //   {"type":"channel","body":{"id":"social","type":"note","body":{...}}}
+    // The views point into the raw frame.
+    struct FrameHead {
+        std::string_view type;      // top-level "type"
+        std::string_view channel;   // body.id (our subscription id)
+        std::string_view event;     // body.type
+    };
+
+    namespace detail {
+        // Minimal forward-only JSON tokenizer over a raw frame
+        // Only what the head scan needs: strings without escapes are returned
+        // as views, everything else is skipped structurally.
+        struct FrameCursor {
+            const char* p;
+            const char* end;
+
+            void ws() {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+            }
+
+            bool eat(char c) {
+                ws();
+                if (p < end && *p == c) {
+                    p++;
+                    return true;
+                }
+                return false;
+            }
+
+            // Skip a string starting at the opening quote; sets `escaped`
+            // when the string contains a backslash
+            bool skip_string(bool& escaped) {
+                escaped = false;
+                p++;
+                while (true) {
+                    const char* q = static_cast<const char*>(std::memchr(p, '"', static_cast<size_t>(end - p)));
+                    if (!q) return false;
+                    if (!escaped && std::memchr(p, '\\', static_cast<size_t>(q - p))) escaped = true;
+                    // The quote is escaped if preceded by an odd run of backslashes
+                    const char* b = q;
+                    while (b > p && b[-1] == '\\') b--;
+                    p = q + 1;
+                    if ((q - b) % 2 == 0) return true;
+                }
+            }
+
+            // Read a string into `out`; fails on escapes so callers fall back
+            // to a full parse rather than compare an undecoded value
+            bool string(std::string_view& out) {
+                ws();
+                if (p >= end || *p != '"') return false;
+                const char* start = p + 1;
+                bool escaped = false;
+                if (!skip_string(escaped) || escaped) return false;
+                out = std::string_view(start, static_cast<size_t>(p - 1 - start));
+                return true;
+            }
+
+            // Skip any value; nested containers are matched by depth
+            bool skip_value() {
+                ws();
+                if (p >= end) return false;
+                if (*p == '"') {
+                    bool escaped;
+                    return skip_string(escaped);
+                }
+                if (*p != '{' && *p != '[') {
+                    while (p < end && *p != ',' && *p != '}' && *p != ']') p++;
+                    return p < end;
+                }
+                int depth = 0;
+                while (p < end) {
+                    char c = *p;
+                    if (c == '"') {
+                        bool escaped;
+                        if (!skip_string(escaped)) return false;
+                        continue;
+                    }
+                    if (c == '{' || c == '[') depth++;
+                    else if (c == '}' || c == ']') {
+                        if (--depth == 0) {
+                            p++;
+                            return true;
+                        }
+                    }
+                    p++;
+                }
+                return false;
+            }
+        };
+    }
+
+    // Fill `head` from the start of a frame
+    // Stops as soon as the routing fields are known, so the note itself is
+    // normally never touched. Returns false if the frame is not shaped as
+    // expected; the caller should then parse it fully.
+    inline bool scan_frame_head(std::string_view raw, FrameHead& head) {
+        detail::FrameCursor c{raw.data(), raw.data() + raw.size()};
+        if (!c.eat('{')) return false;
+
+        bool have_type = false, have_body = false;
+        while (true) {
+            std::string_view key;
+            if (!c.string(key) || !c.eat(':')) return false;
+
+            if (key == "type") {
+                if (!c.string(head.type)) return false;
+                have_type = true;
+                if (head.type != "channel" || have_body) return true;
+            } else if (key == "body") {
+                if (!c.eat('{')) return false;
+                bool have_id = false, have_event = false, closed = false;
+                while (!(have_id && have_event)) {
+                    std::string_view k;
+                    if (!c.string(k) || !c.eat(':')) return false;
+                    if (k == "id") {
+                        if (!c.string(head.channel)) return false;
+                        have_id = true;
+                    } else if (k == "type") {
+                        if (!c.string(head.event)) return false;
+                        have_event = true;
+                    } else if (!c.skip_value()) {
+                        return false;
+                    }
+                    if (c.eat('}')) {
+                        closed = true;
+                        break;
+                    }
+                    if (!c.eat(',')) return false;
+                }
+                if (!have_id || !have_event) return false;
+                if (have_type) return true;
+                have_body = true;
+
+                // "type" comes after body: skip the rest of body to reach it
+                while (!closed && !c.eat('}')) {
+                    std::string_view k;
+                    if (!c.eat(',') || !c.string(k) || !c.eat(':') || !c.skip_value()) return false;
+                }
+            } else if (!c.skip_value()) {
+                return false;
+            }
+
+            if (c.eat('}') || !c.eat(',')) return false;
+        }
+    }
+
+} // namespace Misskey
+
+#endif // FRAME_SCAN
@@ -0,0 +1,120 @@
+#ifndef GAP_BACKFILL
+#define GAP_BACKFILL
+
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <algorithm>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include "misskey.hpp"
+#include "stream_cursor.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    struct BackfillConfig {
+        bool enabled = true;
+        int page_size = 100;  // limit per request (Misskey caps it at 100)
+        int max_pages = 10;   // per channel; a longer gap is only partly recovered
+        size_t max_held_bytes = 16 * 1024 * 1024; // live frames buffered meanwhile; the rest is fetched again
+    };
+
+    // What was posted while a connection was down
+    struct Gap {
+        std::vector<std::string> frames; // channel frames, oldest first
+        bool truncated = false;          // some channel still had more after max_pages
+        int errors = 0;                  // requests that failed (that channel stops there)
+    };
+
+    // REST endpoint that covers a streaming channel id
+    inline std::string backfill_endpoint(const std::string& channel) {
+        if (channel == "main") return "i/notifications";
+        if (channel == "social") return api::timeline_endpoint("hybrid");
+        return api::timeline_endpoint(channel); // local, global, home
+    }
+
+    // Fetch everything newer than each channel's cursor with sinceId
+    // Pages walk forward from the cursor (sinceId alone returns the oldest
+    // matches first). Channels are fetched side by side, one page each per
+    // round, so the api's in-flight limit bounds the parallelism; the result
+    // is merged into one createdAt order and wrapped as the channel frames the
+    // stream would have sent.
+    inline Gap fetch_gap(const api& client, const std::map<std::string, std::string>& since,
+                         const BackfillConfig& config) {
+        struct Item {
+            std::string created_at;
+            std::string id;
+            std::string channel;
+            json body;
+        };
+        struct Walk {
+            std::string channel;
+            std::string endpoint;
+            std::string since_id;
+            int pages = 0;
+            bool done = false;
+        };
+
+        std::vector<Walk> walks;
+        for (const auto& [channel, id] : since) {
+            if (id.empty()) continue;
+            walks.push_back({channel, backfill_endpoint(channel), id});
+        }
+
+        Gap gap;
+        std::vector<Item> items;
+        int limit = std::clamp(config.page_size, 1, 100);
+        while (true) {
+            std::vector<std::pair<Walk*, std::future<json>>> round;
+            for (auto& w : walks) {
+                if (w.done) continue;
+                if (w.pages >= config.max_pages) {
+                    w.done = true;
+                    gap.truncated = true;
+                    continue;
+                }
+                round.emplace_back(&w, client.post_async(w.endpoint, {{"sinceId", w.since_id}, {"limit", limit}}));
+            }
+            if (round.empty()) break;
+
+            for (auto& [w, future] : round) {
+                json page = future.get();
+                w->pages++;
+                if (!page.is_array()) {
+                    std::cerr << "[BACKFILL] " << w->endpoint << " failed: " << page.dump() << std::endl;
+                    gap.errors++;
+                    w->done = true;
+                    continue;
+                }
+                for (auto& item : page) {
+                    std::string id = item.value("id", "");
+                    if (id.empty()) continue;
+                    if (StreamCursor::newer(id, w->since_id)) w->since_id = id;
+                    items.push_back({item.value("createdAt", ""), id, w->channel, std::move(item)});
+                }
+                if (static_cast<int>(page.size()) < limit) w->done = true;
+            }
+        }
+
+        std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+            if (a.created_at != b.created_at) return a.created_at < b.created_at;
+            return StreamCursor::newer(b.id, a.id);
+        });
+        gap.frames.reserve(items.size());
+        for (auto& item : items) {
+            json frame;
+            frame["type"] = "channel";
+            frame["body"]["id"] = item.channel;
+            frame["body"]["type"] = item.channel == "main" ? "notification" : "note";
+            frame["body"]["body"] = std::move(item.body);
+            gap.frames.push_back(frame.dump());
+        }
+        return gap;
+    }
+
+} // namespace Misskey
+
+#endif // GAP_BACKFILL
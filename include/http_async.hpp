@@ -0,0 +1,523 @@
+#ifndef HTTP_ASYNC
+#define HTTP_ASYNC
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+#include "http_pool.hpp"
+#include "rate_limiter.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // cURL write callback
+    inline size_t curl_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
+        auto* buf = static_cast<std::string*>(userdata);
+        buf->append(ptr, size * nmemb);
+        return size * nmemb;
+    }
+
+    // Turn a finished transfer into the JSON the api methods return
+    inline json parse_api_response(CURLcode res, const std::string& response_buf) {
+        if (res != CURLE_OK) {
+            return json{{"error", curl_easy_strerror(res)}};
+        }
+
+        // Some endpoints return empty body on success (e.g. 204 No Content)
+        if (response_buf.empty()) {
+            return json{{"ok", true}};
+        }
+
+        try {
+            return json::parse(response_buf);
+        } catch (...) {
+            return json{{"error", "invalid_json"}, {"raw", response_buf}};
+        }
+    }
+
+    // One multipart/form-data field
+    struct MimeField {
+        std::string name;
+        std::string data;      // value, or local path when is_file
+        std::string filename;  // optional file name sent to the server
+        bool is_file = false;
+    };
+
+    // A POST request for the async engine
+    // Sends `mime` as multipart/form-data when non-empty, `body` as JSON otherwise.
+    struct HttpRequest {
+        std::string url;
+        std::string body;
+        std::vector<MimeField> mime;
+        std::string endpoint;                 // rate limit bucket, e.g. "notes/create"
+        std::string account;                  // whose limits apply (hashed server and token)
+        Priority priority = Priority::Normal;
+    };
+
+    // Collects the Retry-After header of a response
+    inline size_t curl_header_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
+        size_t n = size * nitems;
+        std::string_view line(buffer, n);
+        constexpr std::string_view name = "retry-after:";
+        if (line.size() > name.size() &&
+            std::equal(name.begin(), name.end(), line.begin(),
+                       [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); })) {
+            std::string_view value = line.substr(name.size());
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+            while (!value.empty() && (value.back() == '\r' || value.back() == '\n' || value.back() == ' ')) value.remove_suffix(1);
+            static_cast<std::string*>(userdata)->assign(value);
+        }
+        return n;
+    }
+
+    // Runs many HTTP requests concurrently on one curl_multi handle
+    // A single engine thread drives all transfers; at most max_in_flight run
+    // at once. The rest wait in one FIFO per priority, and a request only
+    // starts when its account's bucket for the endpoint allows (one endpoint
+    // or account being throttled does not hold up the others). 429 and 503
+    // responses are retried after Retry-After or a jittered backoff.
+    // Completion callbacks run on the engine thread, so they must not block
+    // (use the future overload instead).
+    class AsyncEngine {
+    public:
+        using Callback = std::function<void(json)>;
+
+        explicit AsyncEngine(std::shared_ptr<HttpPool> pool, int max_in_flight = 8)
+            : pool(std::move(pool)), max_in_flight(max_in_flight > 0 ? max_in_flight : 1) {
+            multi = curl_multi_init();
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        }
+
+        ~AsyncEngine() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stopping = true;
+            }
+            wake();
+            if (worker.joinable()) worker.join();
+            curl_multi_cleanup(multi);
+        }
+
+        AsyncEngine(const AsyncEngine&) = delete;
+        AsyncEngine& operator=(const AsyncEngine&) = delete;
+
+        void set_max_in_flight(int n) {
+            std::lock_guard<std::mutex> lock(mtx);
+            max_in_flight = n > 0 ? n : 1;
+        }
+
+        void set_rate_limits(RateLimitConfig config) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                limiter.configure(std::move(config));
+            }
+            wake();
+        }
+
+        // Queue a request; cb receives the parsed response
+        void submit(HttpRequest req, Callback cb) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                auto t = std::make_unique<Transfer>(std::move(req), std::move(cb));
+                t->queued = Clock::now();
+                pending[static_cast<size_t>(t->req.priority)].push_back(std::move(t));
+                if (!worker.joinable()) {
+                    worker = std::thread(&AsyncEngine::loop, this);
+                }
+            }
+            wake();
+        }
+
+        // Queue a request and get the parsed response as a future
+        std::future<json> submit(HttpRequest req) {
+            auto promise = std::make_shared<std::promise<json>>();
+            std::future<json> fut = promise->get_future();
+
+            // Waiting on the engine from its own thread would deadlock
+            if (on_engine_thread()) {
+                promise->set_value(perform_inline(req));
+                return fut;
+            }
+
+            submit(std::move(req), [promise](json result) {
+                promise->set_value(std::move(result));
+            });
+            return fut;
+        }
+
+        json get_stats() {
+            std::lock_guard<std::mutex> lock(mtx);
+            json j;
+            j["inFlight"] = in_flight;
+            j["queued"] = pending_count();
+            j["maxInFlight"] = max_in_flight;
+            j["completed"] = completed.load();
+            j["retries"] = retries;
+            j["throttled"] = throttled;
+            j["unavailable"] = unavailable;
+
+            // Time from submit (or a retry's requeue) to the transfer starting
+            json wait;
+            for (size_t p = 0; p < wait_stats.size(); p++) {
+                const auto& w = wait_stats[p];
+                wait[priority_name(static_cast<Priority>(p))] = {
+                    {"queued", pending[p].size()},
+                    {"started", w.count},
+                    {"avgMs", w.count ? static_cast<double>(w.total_ns) / static_cast<double>(w.count) / 1e6 : 0.0},
+                    {"maxMs", static_cast<double>(w.max_ns) / 1e6},
+                };
+            }
+            j["queueWait"] = wait;
+            j["endpoints"] = limiter.stats();
+            return j;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Transfer {
+            HttpRequest req;
+            Callback cb;
+            CURL* easy = nullptr;
+            curl_slist* headers = nullptr;
+            curl_mime* mime = nullptr;
+            std::string response;
+            std::string retry_after;
+            Clock::time_point queued;      // submitted, or requeued for a retry
+            Clock::time_point not_before;  // retry backoff
+            int attempts = 0;
+
+            Transfer(HttpRequest r, Callback c) : req(std::move(r)), cb(std::move(c)) {}
+        };
+
+        struct WaitStats {
+            uint64_t count = 0;
+            uint64_t total_ns = 0;
+            uint64_t max_ns = 0;
+        };
+
+        std::shared_ptr<HttpPool> pool;
+        CURLM* multi = nullptr;
+        std::thread worker;
+        std::atomic<std::thread::id> engine_thread{}; // set by loop(); worker itself is guarded by mtx
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::array<std::deque<std::unique_ptr<Transfer>>, 3> pending; // by Priority
+        std::vector<std::unique_ptr<Transfer>> active;
+        int max_in_flight;
+        int in_flight = 0;
+        bool stopping = false;
+        std::atomic<uint64_t> completed{0};
+
+        // Scheduling (under mtx)
+        RateLimiter limiter;
+        std::array<WaitStats, 3> wait_stats;
+        uint64_t retries = 0;
+        uint64_t throttled = 0;    // 429 responses
+        uint64_t unavailable = 0;  // 503 responses
+
+        size_t pending_count() const {
+            size_t n = 0;
+            for (const auto& q : pending) n += q.size();
+            return n;
+        }
+
+        // When the first queued request may start; max() when none is queued
+        // Once stopping, limits and backoff no longer apply.
+        Clock::time_point next_start(Clock::time_point now) {
+            Clock::time_point next = Clock::time_point::max();
+            for (auto& q : pending) {
+                for (auto& t : q) {
+                    if (stopping) return now;
+                    next = std::min(next, std::max(t->not_before, limiter.ready_at(t->req.account, t->req.endpoint, now)));
+                    if (next <= now) return next;
+                }
+            }
+            return next;
+        }
+
+        bool on_engine_thread() const {
+            return std::this_thread::get_id() == engine_thread.load();
+        }
+
+        void wake() {
+            cv.notify_one();
+            curl_multi_wakeup(multi);
+        }
+
+        // Apply the request to a pooled handle
+        void prepare(CURL* easy, Transfer& t) {
+            curl_easy_setopt(easy, CURLOPT_URL, t.req.url.c_str());
+
+            if (!t.req.mime.empty()) {
+                t.mime = curl_mime_init(easy);
+                for (const auto& f : t.req.mime) {
+                    curl_mimepart* part = curl_mime_addpart(t.mime);
+                    curl_mime_name(part, f.name.c_str());
+                    if (f.is_file) {
+                        curl_mime_filedata(part, f.data.c_str());
+                        if (!f.filename.empty()) curl_mime_filename(part, f.filename.c_str());
+                    } else {
+                        curl_mime_data(part, f.data.c_str(), CURL_ZERO_TERMINATED);
+                    }
+                }
+                curl_easy_setopt(easy, CURLOPT_MIMEPOST, t.mime);
+            } else {
+                t.headers = curl_slist_append(t.headers, "Content-Type: application/json");
+                curl_easy_setopt(easy, CURLOPT_POST, 1L);
+                curl_easy_setopt(easy, CURLOPT_POSTFIELDS, t.req.body.c_str());
+                curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(t.req.body.size()));
+                curl_easy_setopt(easy, CURLOPT_HTTPHEADER, t.headers);
+            }
+
+            curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, curl_write_cb);
+            curl_easy_setopt(easy, CURLOPT_WRITEDATA, &t.response);
+            curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, curl_header_cb);
+            curl_easy_setopt(easy, CURLOPT_HEADERDATA, &t.retry_after);
+            curl_easy_setopt(easy, CURLOPT_PRIVATE, &t);
+        }
+
+        void cleanup(Transfer& t) {
+            if (t.easy) {
+                // Pooled handles are reused; don't leave them pointing at t
+                curl_easy_setopt(t.easy, CURLOPT_HEADERFUNCTION, nullptr);
+                curl_easy_setopt(t.easy, CURLOPT_HEADERDATA, nullptr);
+                pool->release(t.easy);
+                t.easy = nullptr;
+            }
+            if (t.headers) {
+                curl_slist_free_all(t.headers);
+                t.headers = nullptr;
+            }
+            if (t.mime) {
+                curl_mime_free(t.mime);
+                t.mime = nullptr;
+            }
+        }
+
+        // Blocking fallback for requests made from inside a callback
+        // Skips the queue but not the account's bucket or 429/503 retries;
+        // the engine thread sleeps through any wait, like the request itself.
+        json perform_inline(const HttpRequest& req) {
+            Transfer t(req, nullptr);
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    auto now = Clock::now();
+                    auto at = stopping ? now : limiter.ready_at(t.req.account, t.req.endpoint, now);
+                    if (at > now) {
+                        lock.unlock();
+                        std::this_thread::sleep_until(at);
+                        lock.lock();
+                        now = Clock::now();
+                    }
+                    limiter.take(t.req.account, t.req.endpoint, now);
+                }
+
+                t.easy = pool->acquire();
+                if (!t.easy) return json{{"error", "curl_init_failed"}};
+                prepare(t.easy, t);
+                CURLcode res = curl_easy_perform(t.easy);
+                long status = 0;
+                curl_easy_getinfo(t.easy, CURLINFO_RESPONSE_CODE, &status);
+                if (res == CURLE_OK) pool->record(t.easy);
+                cleanup(t);
+
+                if (res == CURLE_OK && (status == 429 || status == 503)) {
+                    Clock::duration delay;
+                    bool again;
+                    {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        again = schedule_retry(t, status, delay);
+                    }
+                    if (again) {
+                        std::this_thread::sleep_for(delay);
+                        t.response.clear();
+                        t.retry_after.clear();
+                        continue;
+                    }
+                }
+                completed++;
+                return parse_api_response(res, t.response);
+            }
+        }
+
+        // Move queued requests into the multi handle, up to the in-flight limit
+        // Highest priority first, FIFO within a priority; a request whose
+        // endpoint is out of tokens or still backing off is passed over.
+        // Returns requests that could not be started.
+        std::vector<std::unique_ptr<Transfer>> start_pending() {
+            std::vector<std::unique_ptr<Transfer>> failed;
+            std::lock_guard<std::mutex> lock(mtx);
+            auto now = Clock::now();
+            for (size_t p = 0; p < pending.size(); p++) {
+                auto& q = pending[p];
+                for (auto it = q.begin(); it != q.end() && in_flight < max_in_flight;) {
+                    Transfer& ready = **it;
+                    if (!stopping && (ready.not_before > now || limiter.ready_at(ready.req.account, ready.req.endpoint, now) > now)) {
+                        ++it;
+                        continue;
+                    }
+                    auto t = std::move(*it);
+                    it = q.erase(it);
+                    limiter.take(t->req.account, t->req.endpoint, now);
+
+                    auto waited = static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - t->queued).count());
+                    WaitStats& w = wait_stats[p];
+                    w.count++;
+                    w.total_ns += waited;
+                    w.max_ns = std::max(w.max_ns, waited);
+
+                    t->easy = pool->acquire();
+                    if (!t->easy) {
+                        failed.push_back(std::move(t));
+                        continue;
+                    }
+                    prepare(t->easy, *t);
+                    curl_multi_add_handle(multi, t->easy);
+                    active.push_back(std::move(t));
+                    in_flight++;
+                }
+            }
+            return failed;
+        }
+
+        // Requeue a 429/503 for another attempt; false once retries are used
+        // up or when repeating the request is not safe
+        bool retry(std::unique_ptr<Transfer>& t, long status) {
+            std::lock_guard<std::mutex> lock(mtx);
+            Clock::duration delay;
+            if (!schedule_retry(*t, status, delay)) return false;
+            auto now = Clock::now();
+            t->not_before = now + delay;
+            t->queued = now;
+            t->response.clear();
+            t->retry_after.clear();
+            pending[static_cast<size_t>(t->req.priority)].push_front(std::move(t));
+            return true;
+        }
+
+        // Retry bookkeeping shared by queued and inline requests (under mtx)
+        bool schedule_retry(Transfer& t, long status, Clock::duration& delay) {
+            if (status == 429) throttled++;
+            else unavailable++;
+            if (stopping || t.attempts >= limiter.config.max_retries ||
+                !limiter.retryable(t.req.endpoint, status)) {
+                return false;
+            }
+            t.attempts++;
+            delay = limiter.backoff(t.attempts, RateLimiter::parse_retry_after(t.retry_after));
+            // 429 is about the endpoint and this token: hold it for that account
+            if (status == 429) limiter.hold(t.req.account, t.req.endpoint, Clock::now() + delay);
+            retries++;
+            return true;
+        }
+
+        // Collect finished transfers from the multi handle
+        struct Done {
+            std::unique_ptr<Transfer> t;
+            CURLcode res;
+            long status;
+        };
+
+        std::vector<Done> collect_done() {
+            std::vector<Done> done;
+            int msgs_left = 0;
+            while (CURLMsg* m = curl_multi_info_read(multi, &msgs_left)) {
+                if (m->msg != CURLMSG_DONE) continue;
+
+                CURL* easy = m->easy_handle;
+                CURLcode res = m->data.result;
+                Transfer* raw = nullptr;
+                long status = 0;
+                curl_easy_getinfo(easy, CURLINFO_PRIVATE, &raw);
+                curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+                curl_multi_remove_handle(multi, easy);
+                if (res == CURLE_OK) pool->record(easy);
+
+                std::lock_guard<std::mutex> lock(mtx);
+                for (auto it = active.begin(); it != active.end(); ++it) {
+                    if (it->get() == raw) {
+                        done.push_back({std::move(*it), res, status});
+                        active.erase(it);
+                        in_flight--;
+                        break;
+                    }
+                }
+            }
+            return done;
+        }
+
+        void loop() {
+            engine_thread = std::this_thread::get_id();
+            while (true) {
+                Clock::time_point next = Clock::time_point::max();
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    // Sleep until a transfer is running or a queued one may start
+                    while (true) {
+                        if (stopping && pending_count() == 0 && in_flight == 0) return;
+                        next = next_start(Clock::now());
+                        if (in_flight > 0 || next <= Clock::now()) break;
+                        if (next == Clock::time_point::max()) cv.wait(lock);
+                        else cv.wait_until(lock, next);
+                    }
+                }
+
+                for (auto& t : start_pending()) {
+                    completed++;
+                    if (t->cb) t->cb(json{{"error", "curl_init_failed"}});
+                }
+
+                int running = 0;
+                curl_multi_perform(multi, &running);
+
+                for (auto& [t, res, status] : collect_done()) {
+                    if (res == CURLE_OK && (status == 429 || status == 503)) {
+                        cleanup(*t);
+                        if (retry(t, status)) continue;
+                    }
+                    json result = parse_api_response(res, t->response);
+                    cleanup(*t);
+                    completed++;
+                    if (t->cb) t->cb(std::move(result));
+                }
+
+                bool busy = false;
+                int timeout_ms = 1000;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    busy = in_flight > 0;
+                    // Also wake for a queued request whose turn comes first
+                    auto now = Clock::now();
+                    next = next_start(now);
+                    if (next != Clock::time_point::max() && in_flight < max_in_flight) {
+                        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+                        timeout_ms = static_cast<int>(std::clamp<int64_t>(ms, 0, timeout_ms));
+                    }
+                }
+                if (busy) {
+                    curl_multi_poll(multi, nullptr, 0, timeout_ms, nullptr);
+                }
+            }
+        }
+    };
+
+} // namespace Misskey
+
+#endif // HTTP_ASYNC
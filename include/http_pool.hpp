@@ -0,0 +1,153 @@
+#ifndef HTTP_POOL
+#define HTTP_POOL
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Connection reuse counters for an HttpPool
+    struct HttpStats {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> connections_opened{0};
+        std::atomic<uint64_t> connections_reused{0};
+        std::atomic<uint64_t> handles_created{0};
+
+        json to_json() const {
+            uint64_t req = requests.load();
+            uint64_t reused = connections_reused.load();
+            json j;
+            j["requests"] = req;
+            j["connectionsOpened"] = connections_opened.load();
+            j["connectionsReused"] = reused;
+            j["handlesCreated"] = handles_created.load();
+            j["reuseRatio"] = req ? static_cast<double>(reused) / static_cast<double>(req) : 0.0;
+            return j;
+        }
+    };
+
+    // Pool of long-lived cURL easy handles
+    // Each handle keeps its own connection cache alive between requests, and
+    // all handles share DNS and TLS session caches through one CURLSH, so a
+    // handle that has to open a new connection can still resume a TLS session.
+    class HttpPool {
+    public:
+        explicit HttpPool(size_t max_idle = 4) : max_idle(max_idle) {
+            global_init();
+
+            share = curl_share_init();
+            if (share) {
+                curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &HttpPool::share_lock);
+                curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &HttpPool::share_unlock);
+                curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            }
+        }
+
+        ~HttpPool() {
+            for (CURL* h : idle) curl_easy_cleanup(h);
+            idle.clear();
+            if (share) curl_share_cleanup(share);
+        }
+
+        HttpPool(const HttpPool&) = delete;
+        HttpPool& operator=(const HttpPool&) = delete;
+
+        // Take a handle with the pool defaults applied
+        // Returns nullptr if curl_easy_init fails
+        CURL* acquire() {
+            CURL* h = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!idle.empty()) {
+                    h = idle.back();
+                    idle.pop_back();
+                }
+            }
+            if (!h) {
+                h = curl_easy_init();
+                if (!h) return nullptr;
+                stats.handles_created++;
+            }
+            apply_defaults(h);
+            return h;
+        }
+
+        // Return a handle to the pool
+        // Per-request options are reset; open connections stay cached.
+        void release(CURL* h) {
+            if (!h) return;
+            curl_easy_reset(h);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (idle.size() < max_idle) {
+                    idle.push_back(h);
+                    return;
+                }
+            }
+            curl_easy_cleanup(h);
+        }
+
+        // Update reuse counters after a finished transfer
+        void record(CURL* h) {
+            long num_connects = 0;
+            curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &num_connects);
+            stats.requests++;
+            if (num_connects > 0) {
+                stats.connections_opened += static_cast<uint64_t>(num_connects);
+            } else {
+                stats.connections_reused++;
+            }
+        }
+
+        // Options every handle gets, before the per-request ones
+        void apply_defaults(CURL* h) const {
+            if (share) curl_easy_setopt(h, CURLOPT_SHARE, share);
+            curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE, 60L);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, 30L);
+            curl_easy_setopt(h, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+            curl_easy_setopt(h, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+            curl_easy_setopt(h, CURLOPT_PIPEWAIT, 1L);
+            curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, "");
+        }
+
+        CURLSH* share_handle() const { return share; }
+
+        json get_stats() const { return stats.to_json(); }
+
+        HttpStats stats;
+
+    private:
+        size_t max_idle;
+        CURLSH* share = nullptr;
+        std::mutex mtx;
+        std::vector<CURL*> idle;
+        std::mutex share_mtx[CURL_LOCK_DATA_LAST];
+
+        static void global_init() {
+            static std::once_flag once;
+            std::call_once(once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+        }
+
+        static void share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+            static_cast<HttpPool*>(userptr)->share_mtx[data].lock();
+        }
+
+        static void share_unlock(CURL*, curl_lock_data data, void* userptr) {
+            static_cast<HttpPool*>(userptr)->share_mtx[data].unlock();
+        }
+    };
+
+} // namespace Misskey
+
+#endif // HTTP_POOL
@@ -0,0 +1,122 @@
+#ifndef JSONL_WRITER
+#define JSONL_WRITER
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// event_line() and binary_event.hpp write through nlohmann's internal
+// serializer/binary_writer, which are not a stable API; xmake.lua pins the
+// release series they were written against
+static_assert(NLOHMANN_JSON_VERSION_MAJOR == 3 && NLOHMANN_JSON_VERSION_MINOR == 11,
+              "event serialisation uses nlohmann::detail; check it against this release and update xmake.lua");
+
+namespace Misskey {
+
+    // Append the current local time as ISO8601 with milliseconds,
+    // e.g. 2026-01-02T03:04:05.678+0900
+    // localtime and strftime run once per second per thread; the rest is
+    // digit arithmetic, so this does not allocate once `out` has capacity.
+    inline void append_timestamp(std::string& out,
+                                 std::chrono::system_clock::time_point now = std::chrono::system_clock::now()) {
+        struct Cache {
+            std::time_t sec = -1;
+            char head[32] = {};   // "%Y-%m-%dT%H:%M:%S"
+            size_t head_len = 0;
+            char zone[16] = {};   // "%z"
+            size_t zone_len = 0;
+        };
+        thread_local Cache cache;
+
+        auto ms_total = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+        std::time_t sec = static_cast<std::time_t>(ms_total / 1000);
+        int ms = static_cast<int>(ms_total % 1000);
+        if (ms < 0) {
+            ms += 1000;
+            sec -= 1;
+        }
+
+        if (sec != cache.sec) {
+            std::tm tm_buf;
+#ifdef _WIN32
+            localtime_s(&tm_buf, &sec);
+#else
+            localtime_r(&sec, &tm_buf);
+#endif
+            cache.head_len = std::strftime(cache.head, sizeof(cache.head), "%Y-%m-%dT%H:%M:%S", &tm_buf);
+            cache.zone_len = std::strftime(cache.zone, sizeof(cache.zone), "%z", &tm_buf);
+            cache.sec = sec;
+        }
+
+        char frac[4] = {'.', static_cast<char>('0' + ms / 100),
+                        static_cast<char>('0' + ms / 10 % 10), static_cast<char>('0' + ms % 10)};
+        out.append(cache.head, cache.head_len);
+        out.append(frac, sizeof(frac));
+        out.append(cache.zone, cache.zone_len);
+    }
+
+    // Append `s` as a JSON string literal
+    inline void append_json_string(std::string& out, std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        size_t run = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s.data() + run, i - run);
+            run = i + 1;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(esc, sizeof(esc));
+            }
+        }
+        out.append(s.data() + run, s.size() - run);
+        out += '"';
+    }
+
+    // Serialise one output line, {"ts":..,"event":..,"data":..}, without a
+    // trailing newline; a non-empty `account` adds "account" after "ts"
+    // The line is written straight into a buffer owned by the calling thread
+    // and reused for every event, so after the first few events no memory
+    // is allocated here. The returned reference is valid until the next call
+    // on the same thread.
+    inline const std::string& event_line(std::string_view event, const json& data,
+                                         std::string_view account = {}) {
+        struct Writer {
+            std::string buf;
+            nlohmann::detail::serializer<json> ser{
+                std::make_shared<nlohmann::detail::output_string_adapter<char>>(buf),
+                ' ', json::error_handler_t::replace};
+        };
+        thread_local Writer w;
+
+        w.buf.clear();
+        w.buf.append("{\"ts\":\"");
+        append_timestamp(w.buf);
+        w.buf += '"';
+        if (!account.empty()) {
+            w.buf.append(",\"account\":");
+            append_json_string(w.buf, account);
+        }
+        w.buf.append(",\"event\":");
+        append_json_string(w.buf, event);
+        w.buf.append(",\"data\":");
+        w.ser.dump(data, false, false, 0);
+        w.buf += '}';
+        return w.buf;
+    }
+
+} // namespace Misskey
+
+#endif // JSONL_WRITER
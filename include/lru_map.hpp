@@ -0,0 +1,59 @@
+#ifndef LRU_MAP
+#define LRU_MAP
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <iterator>
+#include <algorithm>
+
+namespace Misskey {
+
+    // String-keyed map that forgets the least recently used key when full
+    // Not thread safe; owners lock around it. Once full, the evicted node is
+    // reused for the new key, so steady state does no list allocations.
+    template <typename V>
+    class LruMap {
+    public:
+        // Value for `key`, marked most recently used; nullptr when absent
+        V* find(std::string_view key) {
+            auto it = index.find(key);
+            if (it == index.end()) return nullptr;
+            nodes.splice(nodes.begin(), nodes, it->second);
+            return &it->second->value;
+        }
+
+        // Add `key` (which must be absent) as most recently used
+        // A reused slot keeps its old value: the caller overwrites it.
+        // Returns true in `evicted` when another key had to go.
+        V& insert(std::string_view key, size_t capacity, bool& evicted) {
+            evicted = nodes.size() >= std::max<size_t>(capacity, 1);
+            if (evicted) {
+                auto last = std::prev(nodes.end());
+                index.erase(last->key);
+                nodes.splice(nodes.begin(), nodes, last);
+            } else {
+                nodes.emplace_front();
+            }
+            Node& n = nodes.front();
+            n.key.assign(key);
+            index.emplace(n.key, nodes.begin());
+            return n.value;
+        }
+
+        size_t size() const { return nodes.size(); }
+
+    private:
+        struct Node {
+            std::string key;
+            V value{};
+        };
+
+        std::list<Node> nodes;  // most recently used first
+        std::unordered_map<std::string_view, typename std::list<Node>::iterator> index; // keys view Node::key
+    };
+
+} // namespace Misskey
+
+#endif // LRU_MAP
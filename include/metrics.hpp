@@ -0,0 +1,228 @@
+#ifndef METRICS
+#define METRICS
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <chrono>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Latency histogram with HDR-style log-linear buckets
+    // Every power of two is split into 16 linear sub-buckets, so any value is
+    // stored with at most ~6% error, from 1 ns up to hours, in a fixed 8 KB
+    // table. Recording is a few relaxed atomic adds and never allocates.
+    class LatencyHistogram {
+    public:
+        void record(std::chrono::nanoseconds d) {
+            uint64_t ns = d.count() > 0 ? static_cast<uint64_t>(d.count()) : 0;
+            buckets[index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum_ns.fetch_add(ns, std::memory_order_relaxed);
+            uint64_t prev = max_ns.load(std::memory_order_relaxed);
+            while (ns > prev && !max_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+        }
+
+        uint64_t total() const { return count.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return sum_ns.load(std::memory_order_relaxed); }
+        uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+
+        // Value (ns) at quantile q in [0, 1]; the upper edge of its bucket
+        uint64_t quantile(double q) const {
+            uint64_t n = total();
+            if (n == 0) return 0;
+            auto target = static_cast<uint64_t>(q * static_cast<double>(n) + 0.5);
+            if (target < 1) target = 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucket_count; i++) {
+                seen += buckets[i].load(std::memory_order_relaxed);
+                if (seen >= target) return std::min(upper_of(i), max());
+            }
+            return max();
+        }
+
+        // Summary in microseconds
+        json to_json() const {
+            uint64_t n = total();
+            auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+            return json{
+                {"count", n},
+                {"meanUs", n ? us(sum()) / static_cast<double>(n) : 0.0},
+                {"p50Us", us(quantile(0.50))},
+                {"p90Us", us(quantile(0.90))},
+                {"p99Us", us(quantile(0.99))},
+                {"maxUs", us(max())},
+            };
+        }
+
+    private:
+        static constexpr int sub_bits = 4;
+        static constexpr size_t bucket_count = size_t(64) << sub_bits;
+
+        std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+
+        static size_t index_of(uint64_t v) {
+            if (v < (uint64_t(1) << sub_bits)) return static_cast<size_t>(v);
+            int shift = static_cast<int>(std::bit_width(v)) - 1 - sub_bits;
+            return (static_cast<size_t>(shift + 1) << sub_bits) +
+                   static_cast<size_t>((v >> shift) & ((uint64_t(1) << sub_bits) - 1));
+        }
+
+        static uint64_t upper_of(size_t idx) {
+            if (idx < (size_t(1) << sub_bits)) return idx;
+            int shift = static_cast<int>(idx >> sub_bits) - 1;
+            uint64_t mant = (idx & ((size_t(1) << sub_bits) - 1)) | (uint64_t(1) << sub_bits);
+            return ((mant + 1) << shift) - 1;
+        }
+    };
+
+    // Pipeline stages, from a frame arriving to the command finishing
+    enum class Stage {
+        Receive,    // whole websocket callback for one frame
+        Parse,      // prefilter and json::parse
+        Extract,    // extract_note / payload building
+        Emit,       // serialise and hand to the output writer
+        Enqueue,    // push onto a command worker's queue
+        QueueWait,  // time spent queued before a worker picks it up
+        Spawn,      // fork/exec (or CreateProcess) of the command
+        ChildRun,   // spawned command runtime; stdin write time in persistent mode
+        Count,
+    };
+
+    inline constexpr const char* stage_names[] = {
+        "receive", "parse", "extract", "emit", "enqueue", "queue_wait", "spawn", "child_run",
+    };
+
+    // Latency histograms and counters for the stream pipeline
+    class Metrics {
+    public:
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> bytes_received{0};
+        std::atomic<uint64_t> connects{0};
+        std::atomic<uint64_t> reconnected{0}; // connects after a connection dropped
+
+        void record(Stage s, std::chrono::nanoseconds d) {
+            stages[static_cast<size_t>(s)].record(d);
+        }
+
+        const LatencyHistogram& stage(Stage s) const {
+            return stages[static_cast<size_t>(s)];
+        }
+
+        void count_event(std::string_view event) {
+            size_t i = 0;
+            while (i + 1 < std::size(event_names) && event != event_names[i]) i++;
+            event_counts[i].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t reconnects() const {
+            return reconnected.load();
+        }
+
+        json to_json() const {
+            json j;
+            for (size_t i = 0; i < static_cast<size_t>(Stage::Count); i++) {
+                j["stages"][stage_names[i]] = stages[i].to_json();
+            }
+            j["events"] = json::object();
+            for (size_t i = 0; i < std::size(event_names); i++) {
+                uint64_t n = event_counts[i].load();
+                if (n) j["events"][event_names[i]] = n;
+            }
+            j["frames"] = frames.load();
+            j["bytesReceived"] = bytes_received.load();
+            j["reconnects"] = reconnects();
+            return j;
+        }
+
+        // Prometheus text exposition of the histograms and counters
+        // Latencies are summaries (quantiles in seconds); callers append
+        // their own counters with prom_counter().
+        std::string prometheus() const {
+            std::string out;
+            out += "# HELP what_stage_latency_seconds Latency of each stream pipeline stage\n";
+            out += "# TYPE what_stage_latency_seconds summary\n";
+            for (size_t i = 0; i < static_cast<size_t>(Stage::Count); i++) {
+                const auto& h = stages[i];
+                std::string label = std::string("stage=\"") + stage_names[i] + "\"";
+                for (double q : {0.5, 0.9, 0.99}) {
+                    char qs[16];
+                    std::snprintf(qs, sizeof(qs), "%g", q);
+                    prom_line(out, "what_stage_latency_seconds", label + ",quantile=\"" + qs + "\"",
+                              static_cast<double>(h.quantile(q)) / 1e9);
+                }
+                prom_line(out, "what_stage_latency_seconds_sum", label, static_cast<double>(h.sum()) / 1e9);
+                prom_line(out, "what_stage_latency_seconds_count", label, static_cast<double>(h.total()));
+            }
+
+            out += "# TYPE what_events_total counter\n";
+            for (size_t i = 0; i < std::size(event_names); i++) {
+                prom_line(out, "what_events_total", std::string("event=\"") + event_names[i] + "\"",
+                          static_cast<double>(event_counts[i].load()));
+            }
+            prom_counter(out, "what_frames_total", frames.load());
+            prom_counter(out, "what_received_bytes_total", bytes_received.load());
+            prom_counter(out, "what_reconnects_total", reconnects());
+            return out;
+        }
+
+        static void prom_counter(std::string& out, const char* name, uint64_t value) {
+            out += "# TYPE ";
+            out += name;
+            out += " counter\n";
+            prom_line(out, name, "", static_cast<double>(value));
+        }
+
+        static void prom_line(std::string& out, const std::string& name, const std::string& labels, double value) {
+            char num[32];
+            std::snprintf(num, sizeof(num), "%.9g", value);
+            out += name;
+            if (!labels.empty()) out += "{" + labels + "}";
+            out += ' ';
+            out += num;
+            out += '\n';
+        }
+
+    private:
+        static constexpr const char* event_names[] = {
+            "note", "notification", "mention", "followed", "unreadNotification",
+            "channel_event", "timeline_event", "main_event", "unknown",
+            "connected", "disconnected", "error", "reconnecting", "other",
+        };
+
+        std::array<LatencyHistogram, static_cast<size_t>(Stage::Count)> stages;
+        std::array<std::atomic<uint64_t>, std::size(event_names)> event_counts{};
+    };
+
+    // Records the time from construction to destruction into one stage
+    class StageTimer {
+    public:
+        StageTimer(Metrics* m, Stage s) : m(m), s(s), started(std::chrono::steady_clock::now()) {}
+        ~StageTimer() {
+            if (m) m->record(s, std::chrono::steady_clock::now() - started);
+        }
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        Metrics* m;
+        Stage s;
+        std::chrono::steady_clock::time_point started;
+    };
+
+} // namespace Misskey
+
+#endif // METRICS
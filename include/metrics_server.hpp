@@ -0,0 +1,155 @@
+#ifndef METRICS_SERVER
+#define METRICS_SERVER
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <cstdlib>
+#include "rpc_server.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+namespace Misskey {
+
+#ifndef _WIN32
+    // Minimal HTTP endpoint for Prometheus scrapes
+    // Listens on "host:port" (TCP) or "unix:/path" and answers GET /metrics
+    // with whatever `render` returns. One request per connection, served on
+    // a single background thread: scrapes are rare and cheap.
+    class MetricsServer {
+    public:
+        using Render = std::function<std::string()>;
+
+        explicit MetricsServer(Render render) : render(std::move(render)) {}
+
+        ~MetricsServer() {
+            stop();
+        }
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer& operator=(const MetricsServer&) = delete;
+
+        bool listen(const std::string& address) {
+            if (address.rfind("unix:", 0) == 0) {
+                std::string socket_path = address.substr(5);
+                sockaddr_un addr;
+                if (!detail::make_unix_addr(socket_path, addr)) {
+                    std::cerr << "[METRICS] socket path too long: " << socket_path << std::endl;
+                    return false;
+                }
+                ::unlink(socket_path.c_str());
+                listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                    return fail(address);
+                }
+                path = socket_path;
+            } else {
+                auto colon = address.rfind(':');
+                if (colon == std::string::npos) {
+                    std::cerr << "[METRICS] expected host:port or unix:/path, got " << address << std::endl;
+                    return false;
+                }
+                long port = std::strtol(address.c_str() + colon + 1, nullptr, 10);
+                if (port <= 0 || port > 65535) {
+                    std::cerr << "[METRICS] invalid port in " << address << std::endl;
+                    return false;
+                }
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(static_cast<uint16_t>(port));
+                std::string host = address.substr(0, colon);
+                if (host.empty()) host = "127.0.0.1";
+                if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+                    std::cerr << "[METRICS] invalid IPv4 address: " << host << std::endl;
+                    return false;
+                }
+                listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                int one = 1;
+                if (listen_fd >= 0) ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                    return fail(address);
+                }
+            }
+            if (::listen(listen_fd, 16) != 0) return fail(address);
+
+            running = true;
+            thread = std::thread(&MetricsServer::serve, this);
+            return true;
+        }
+
+        void stop() {
+            if (!running.exchange(false)) return;
+            ::shutdown(listen_fd, SHUT_RDWR);
+            ::close(listen_fd);
+            listen_fd = -1;
+            if (thread.joinable()) thread.join();
+            if (!path.empty()) ::unlink(path.c_str());
+        }
+
+    private:
+        Render render;
+        std::string path;
+        int listen_fd = -1;
+        std::atomic<bool> running{false};
+        std::thread thread;
+
+        bool fail(const std::string& address) {
+            std::cerr << "[METRICS] cannot listen on " << address << ": " << strerror(errno) << std::endl;
+            if (listen_fd >= 0) ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+
+        void serve() {
+            while (running) {
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    if (!running) break;
+                    continue;
+                }
+                // Don't let a stalled client hold the endpoint
+                timeval tv{2, 0};
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                respond(fd);
+                ::close(fd);
+            }
+        }
+
+        void respond(int fd) {
+            std::string request;
+            char buf[1024];
+            while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+                ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) return;
+                request.append(buf, static_cast<size_t>(n));
+            }
+
+            std::string status = "200 OK", body;
+            if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0) {
+                body = render();
+            } else {
+                status = "404 Not Found";
+                body = "not found\n";
+            }
+            std::string response = "HTTP/1.0 " + status + "\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+            detail::write_all(fd, response);
+        }
+    };
+#endif // !_WIN32
+
+} // namespace Misskey
+
+#endif // METRICS_SERVER
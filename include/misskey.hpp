@@ -3,71 +3,93 @@
 
 #include <iostream>
 #include <string>
+#include <memory>
+#include <future>
+#include <functional>
+#include <cstdio>
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
+#include "http_pool.hpp"
+#include "http_async.hpp"
+#include "response_cache.hpp"
 
 using json = nlohmann::json;
 
 namespace Misskey {
 
-    // cURL write callback
-    inline size_t curl_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
-        auto* buf = static_cast<std::string*>(userdata);
-        buf->append(ptr, size * nmemb);
-        return size * nmemb;
-    }
-
     class api {
     public:
         std::string uri;
         std::string token;
+        std::string scheme = "https"; // "http" for a local mock server
 
-        api(const std::string& uri, const std::string& token)
-            : uri(uri), token(token) {}
+        // Shared by copies of this api, so they reuse the same connections
+        std::shared_ptr<HttpPool> http;
+        std::shared_ptr<AsyncEngine> engine;
 
-        // Generic POST to /api/<endpoint>
-        json post(const std::string& endpoint, json body = {}) const {
-            std::string url = "https://" + uri + "/api/" + endpoint;
-            body["i"] = token;
-            std::string body_str = body.dump();
+        // On-disk cache for note_show / user_show / me (nullptr = off)
+        std::shared_ptr<ResponseCache> cache;
+        int cache_max_age_s = -1; // oldest cached answer accepted: -1 = cache->ttl_s, 0 = always fetch
 
-            CURL* curl = curl_easy_init();
-            std::string response_buf;
+        api(const std::string& uri, const std::string& token, int max_in_flight = 8)
+            : uri(uri), token(token),
+              http(std::make_shared<HttpPool>()),
+              engine(std::make_shared<AsyncEngine>(http, max_in_flight)) {}
 
-            if (!curl) {
-                std::cerr << "curl_easy_init failed" << std::endl;
-                return json{{"error", "curl_init_failed"}};
-            }
+        // Connection reuse counters
+        json connection_stats() const {
+            return http->get_stats();
+        }
 
-            struct curl_slist* headers = nullptr;
-            headers = curl_slist_append(headers, "Content-Type: application/json");
+        // Limit on concurrently running requests
+        void set_max_in_flight(int n) const {
+            engine->set_max_in_flight(n);
+        }
 
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body_str.c_str());
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, body_str.size());
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_buf);
+        // Per-endpoint request rates, priorities and 429/503 retries
+        void set_rate_limits(RateLimitConfig config) const {
+            engine->set_rate_limits(std::move(config));
+        }
 
-            CURLcode res = curl_easy_perform(curl);
-            curl_slist_free_all(headers);
-            curl_easy_cleanup(curl);
+        // Generic POST to /api/<endpoint>
+        json post(const std::string& endpoint, json body = {}) const {
+            return post_async(endpoint, std::move(body)).get();
+        }
 
-            if (res != CURLE_OK) {
-                return json{{"error", curl_easy_strerror(res)}};
-            }
+        std::future<json> post_async(const std::string& endpoint, json body = {}) const {
+            invalidate_for(endpoint, body);
+            return engine->submit(make_request(endpoint, std::move(body)));
+        }
 
-            // Some endpoints return empty body on success (e.g. 204 No Content)
-            if (response_buf.empty()) {
-                return json{{"ok", true}};
-            }
+        // Callback runs on the engine thread and must not block
+        void post_async(const std::string& endpoint, json body,
+                        AsyncEngine::Callback cb) const {
+            invalidate_for(endpoint, body);
+            engine->submit(make_request(endpoint, std::move(body)), std::move(cb));
+        }
 
-            try {
-                return json::parse(response_buf);
-            } catch (...) {
-                return json{{"error", "invalid_json"}, {"raw", response_buf}};
+        // post_async() through the cache: a fresh enough copy is returned
+        // without a request, and a successful response is stored
+        std::future<json> cached_post_async(const std::string& endpoint, json body) const {
+            if (!cache || !cache->is_open()) return post_async(endpoint, std::move(body));
+
+            std::string key = cache_key(endpoint, body);
+            int max_age = cache_max_age_s < 0 ? cache->ttl_s : cache_max_age_s;
+            std::string hit;
+            if (max_age > 0 && cache->get(key, max_age, hit)) {
+                try {
+                    std::promise<json> ready;
+                    ready.set_value(json::parse(hit));
+                    return ready.get_future();
+                } catch (const json::parse_error&) {}
             }
+            // Stored by whoever waits for the answer
+            return std::async(std::launch::deferred,
+                [cache = cache, key = std::move(key), response = post_async(endpoint, std::move(body))]() mutable {
+                    json result = response.get();
+                    if (result.is_object() && !result.contains("error")) cache->put(key, result.dump());
+                    return result;
+                });
         }
 
         // ---- Notes ----
@@ -101,27 +123,43 @@ namespace Misskey {
         }
 
         json note_show(const std::string& note_id) const {
-            return post("notes/show", {{"noteId", note_id}});
+            return note_show_async(note_id).get();
+        }
+
+        std::future<json> note_show_async(const std::string& note_id) const {
+            return cached_post_async("notes/show", {{"noteId", note_id}});
         }
 
         json timeline(const std::string& type = "hybrid", int limit = 10) const {
-            std::string endpoint = "notes/hybrid-timeline";
-            if (type == "local") endpoint = "notes/local-timeline";
-            else if (type == "global") endpoint = "notes/global-timeline";
-            else if (type == "home") endpoint = "notes/timeline";
-            return post(endpoint, {{"limit", limit}});
+            return post(timeline_endpoint(type), {{"limit", limit}});
+        }
+
+        static std::string timeline_endpoint(const std::string& type) {
+            if (type == "local") return "notes/local-timeline";
+            if (type == "global") return "notes/global-timeline";
+            if (type == "home") return "notes/timeline";
+            return "notes/hybrid-timeline";
         }
 
         // ---- Reactions ----
 
         json reaction_create(const std::string& note_id,
                              const std::string& reaction) const {
-            return post("notes/reactions/create",
-                        {{"noteId", note_id}, {"reaction", reaction}});
+            return reaction_create_async(note_id, reaction).get();
+        }
+
+        std::future<json> reaction_create_async(const std::string& note_id,
+                                                const std::string& reaction) const {
+            return post_async("notes/reactions/create",
+                              {{"noteId", note_id}, {"reaction", reaction}});
         }
 
         json reaction_delete(const std::string& note_id) const {
-            return post("notes/reactions/delete", {{"noteId", note_id}});
+            return reaction_delete_async(note_id).get();
+        }
+
+        std::future<json> reaction_delete_async(const std::string& note_id) const {
+            return post_async("notes/reactions/delete", {{"noteId", note_id}});
         }
 
         // ---- Notifications ----
@@ -134,14 +172,19 @@ namespace Misskey {
 
         json user_show(const std::string& username,
                        const std::string& host = "") const {
+            return user_show_async(username, host).get();
+        }
+
+        std::future<json> user_show_async(const std::string& username,
+                                          const std::string& host = "") const {
             json body;
             body["username"] = username;
             if (!host.empty()) body["host"] = host;
-            return post("users/show", body);
+            return cached_post_async("users/show", body);
         }
 
         json me() const {
-            return post("i");
+            return cached_post_async("i", json::object()).get();
         }
 
         // ---- Follow ----
@@ -170,74 +213,15 @@ namespace Misskey {
                          const std::string& name = "",
                          const std::string& folder_id = "",
                          bool is_sensitive = false) const {
-            std::string url = "https://" + uri + "/api/drive/files/create";
-
-            CURL* curl = curl_easy_init();
-            std::string response_buf;
-
-            if (!curl) {
-                return json{{"error", "curl_init_failed"}};
-            }
-
-            curl_mime* mime = curl_mime_init(curl);
-
-            // Token
-            curl_mimepart* part = curl_mime_addpart(mime);
-            curl_mime_name(part, "i");
-            curl_mime_data(part, token.c_str(), CURL_ZERO_TERMINATED);
-
-            // File
-            part = curl_mime_addpart(mime);
-            curl_mime_name(part, "file");
-            curl_mime_filedata(part, file_path.c_str());
-            if (!name.empty()) {
-                curl_mime_filename(part, name.c_str());
-            }
-
-            // Optional name field
-            if (!name.empty()) {
-                part = curl_mime_addpart(mime);
-                curl_mime_name(part, "name");
-                curl_mime_data(part, name.c_str(), CURL_ZERO_TERMINATED);
-            }
-
-            // Optional folder ID
-            if (!folder_id.empty()) {
-                part = curl_mime_addpart(mime);
-                curl_mime_name(part, "folderId");
-                curl_mime_data(part, folder_id.c_str(), CURL_ZERO_TERMINATED);
-            }
-
-            // Sensitive flag
-            if (is_sensitive) {
-                part = curl_mime_addpart(mime);
-                curl_mime_name(part, "isSensitive");
-                curl_mime_data(part, "true", CURL_ZERO_TERMINATED);
-            }
-
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_buf);
-
-            CURLcode res = curl_easy_perform(curl);
-            curl_mime_free(mime);
-            curl_easy_cleanup(curl);
-
-            if (res != CURLE_OK) {
-                return json{{"error", curl_easy_strerror(res)}};
-            }
-
-            // Some endpoints return empty body on success (e.g. 204 No Content)
-            if (response_buf.empty()) {
-                return json{{"ok", true}};
-            }
+            return engine->submit(make_upload_request(file_path, name, folder_id, is_sensitive)).get();
+        }
 
-            try {
-                return json::parse(response_buf);
-            } catch (...) {
-                return json{{"error", "invalid_json"}, {"raw", response_buf}};
-            }
+        void drive_upload_async(const std::string& file_path,
+                                const std::string& name,
+                                const std::string& folder_id,
+                                bool is_sensitive,
+                                AsyncEngine::Callback cb) const {
+            engine->submit(make_upload_request(file_path, name, folder_id, is_sensitive), std::move(cb));
         }
 
         // Create a note with file attachments
@@ -272,6 +256,80 @@ namespace Misskey {
         json poll_vote(const std::string& note_id, int choice) const {
             return post("notes/polls/vote", {{"noteId", note_id}, {"choice", choice}});
         }
+
+    private:
+        // Server, account (hashed, so the token never reaches the file),
+        // endpoint and body
+        std::string cache_key(const std::string& endpoint, const json& body) const {
+            return scheme + "://" + uri + "\n" + std::to_string(std::hash<std::string>{}(token)) + "\n" +
+                   endpoint + "\n" + body.dump();
+        }
+
+        // Server and token, hashed: copies for other accounts share the
+        // engine but not its rate limit buckets
+        std::string rate_account() const {
+            char buf[17];
+            std::snprintf(buf, sizeof(buf), "%08zx",
+                          std::hash<std::string>{}(scheme + "://" + uri + "\n" + token) & 0xffffffffu);
+            return buf;
+        }
+
+        // Our own changes to a note make its cached notes/show stale
+        void invalidate_for(const std::string& endpoint, const json& body) const {
+            if (!cache || !cache->is_open()) return;
+            if (endpoint != "notes/delete" && endpoint != "notes/reactions/create" &&
+                endpoint != "notes/reactions/delete" && endpoint != "notes/polls/vote") {
+                return;
+            }
+            auto id = body.find("noteId");
+            if (id == body.end() || !id->is_string()) return;
+            cache->invalidate(cache_key("notes/show", {{"noteId", *id}}));
+        }
+
+        HttpRequest make_request(const std::string& endpoint, json body) const {
+            body["i"] = token;
+            HttpRequest req;
+            req.url = scheme + "://" + uri + "/api/" + endpoint;
+            req.body = body.dump();
+            req.endpoint = endpoint;
+            req.account = rate_account();
+            req.priority = default_priority(endpoint);
+            return req;
+        }
+
+        HttpRequest make_upload_request(const std::string& file_path,
+                                        const std::string& name,
+                                        const std::string& folder_id,
+                                        bool is_sensitive) const {
+            HttpRequest req;
+            req.url = scheme + "://" + uri + "/api/drive/files/create";
+            req.endpoint = "drive/files/create";
+            req.account = rate_account();
+            req.priority = default_priority(req.endpoint);
+
+            // Token
+            req.mime.push_back({"i", token, "", false});
+
+            // File
+            req.mime.push_back({"file", file_path, name, true});
+
+            // Optional name field
+            if (!name.empty()) {
+                req.mime.push_back({"name", name, "", false});
+            }
+
+            // Optional folder ID
+            if (!folder_id.empty()) {
+                req.mime.push_back({"folderId", folder_id, "", false});
+            }
+
+            // Sensitive flag
+            if (is_sensitive) {
+                req.mime.push_back({"isSensitive", "true", "", false});
+            }
+
+            return req;
+        }
     };
 }
 
@@ -2,13 +2,21 @@
 #define MISSKEY_WEBSOCKET
 
 #include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
 #include <thread>
+#include <atomic>
 #include <chrono>
+#include <utility>
 #include <ixwebsocket/IXNetSystem.h>
 #include <ixwebsocket/IXWebSocket.h>
 #include <ixwebsocket/IXUserAgent.h>
 #include <nlohmann/json.hpp>
 #include "event_handler.hpp"
+#include "frame_log.hpp"
+#include "gap_backfill.hpp"
+#include "stream_cursor.hpp"
 
 using json = nlohmann::json;
 
@@ -16,35 +24,92 @@ namespace Misskey {
     class websocket {
         public:
             EventHandler& handler;
+            FrameLogWriter* recorder = nullptr; // set to save raw frames (what record)
+            bool tls = true;                     // false: ws:// (local mock server)
+            std::string account;                 // tags this connection's events ("" = untagged)
+            std::vector<std::string> channels = {"main", "hybridTimeline"};
+            const api* client = nullptr;         // set to backfill what a reconnect missed
+            BackfillConfig backfill;
 
             explicit websocket(EventHandler& h) : handler(h) {}
 
-            void connect(std::string uri, std::string token) {
+            ~websocket() {
+                stop();
+            }
+
+            websocket(const websocket&) = delete;
+            websocket& operator=(const websocket&) = delete;
+
+            // Connect in the background; ixwebsocket reconnects on its own
+            // and runs this connection's callbacks on its own thread
+            void start(const std::string& uri, const std::string& token) {
                 ix::initNetSystem();
 
                 connected_uri = uri;
 
-                std::string url = "wss://" + uri + "/streaming?i=" + token;
+                std::string url = (tls ? "wss://" : "ws://") + uri + "/streaming?i=" + token;
                 ws.setUrl(url);
                 ws.enableAutomaticReconnection();
 
                 ws.setOnMessageCallback(std::bind(&websocket::onMessage, this, std::placeholders::_1));
                 ws.start();
+            }
 
-                // Keep alive with a sleep to avoid busy-wait
-                while (true) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                }
+            // Close the connection and stop reconnecting; no callbacks run
+            // once this returns
+            void stop() {
+                stopping = true;
+                ws.disableAutomaticReconnection();
+                ws.stop();
+                if (backfill_thread.joinable()) backfill_thread.join();
+            }
+
+            // Subscription id for a channel; the timeline ids are the
+            // channel names EventHandler knows
+            static std::string channel_id(const std::string& channel) {
+                if (channel == "hybridTimeline") return "social";
+                if (channel == "localTimeline") return "local";
+                if (channel == "globalTimeline") return "global";
+                if (channel == "homeTimeline") return "home";
+                return channel;
             }
 
         private:
             ix::WebSocket ws;
             std::string connected_uri;
+            StreamCursor cursor;
+
+            // Backfill after a reconnect; live frames wait in `held` meanwhile,
+            // up to backfill.max_held_bytes
+            std::thread backfill_thread;
+            std::mutex hold_mtx;
+            bool holding = false;
+            std::vector<std::string> held;
+            size_t held_bytes = 0;
+            uint64_t held_dropped = 0; // frames past the limit, to be fetched again
+            bool was_open = false;
+            std::chrono::system_clock::time_point opened_at;
+            std::chrono::system_clock::time_point closed_at;
+            std::atomic<bool> stopping{false};
 
             void onMessage(const ix::WebSocketMessagePtr& msg) {
+                AccountScope scope(account, &cursor);
                 switch (msg->type)
                 {
                     case ix::WebSocketMessageType::Message:
+                        if (recorder) recorder->write(msg->str);
+                        {
+                            std::lock_guard<std::mutex> lock(hold_mtx);
+                            if (holding) {
+                                if (held_bytes + msg->str.size() > backfill.max_held_bytes) {
+                                    held_dropped++;
+                                } else {
+                                    held_bytes += msg->str.size();
+                                    held.push_back(msg->str);
+                                }
+                                break;
+                            }
+                        }
                         handler.handle(msg->str);
                         break;
 
@@ -53,10 +118,13 @@ namespace Misskey {
                         break;
 
                     case ix::WebSocketMessageType::Close:
+                        closed_at = std::chrono::system_clock::now();
                         handler.emit_disconnected(msg->closeInfo.reason);
                         break;
 
                     case ix::WebSocketMessageType::Error:
+                        // A dropped connection may surface only as an error
+                        if (closed_at < opened_at) closed_at = std::chrono::system_clock::now();
                         handler.emit_error("ws_error", msg->errorInfo.reason);
                         break;
                     
@@ -66,19 +134,75 @@ namespace Misskey {
             }
 
             void onWsOpen() {
-                handler.emit_connected(connected_uri);
-
-                json data;
-                data["type"] = "connect";
-                data["body"]["channel"] = "main";
-                data["body"]["id"] = "main";
-                ws.send(data.dump().c_str());
-
-                data.clear();
-                data["type"] = "connect";
-                data["body"]["channel"] = "hybridTimeline";
-                data["body"]["id"] = "social";
-                ws.send(data.dump().c_str());
+                handler.emit_connected(connected_uri, was_open);
+
+                for (const auto& channel : channels) {
+                    json data;
+                    data["type"] = "connect";
+                    data["body"]["channel"] = channel;
+                    data["body"]["id"] = channel_id(channel);
+                    ws.send(data.dump().c_str());
+                }
+
+                // Subscribed first, so anything posted from here on is either
+                // held live or fetched (and then deduplicated)
+                if (was_open && client && backfill.enabled) start_backfill();
+                was_open = true;
+                opened_at = std::chrono::system_clock::now();
+            }
+
+            void start_backfill() {
+                {
+                    std::lock_guard<std::mutex> lock(hold_mtx);
+                    if (holding) return; // the running backfill still covers this gap
+                    holding = true;
+                }
+                if (backfill_thread.joinable()) backfill_thread.join();
+                auto gap_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now() - closed_at).count();
+                backfill_thread = std::thread(&websocket::run_backfill, this, gap_ms);
+            }
+
+            // Emit the gap oldest first, then the frames held meanwhile
+            // Frames dropped for want of room are newer than everything held,
+            // so once the buffer is out they are one more gap to fetch.
+            void run_backfill(long long gap_ms) {
+                AccountScope scope(account, &cursor);
+                std::vector<std::string> pending;
+                while (true) {
+                    Gap gap = fetch_gap(*client, cursor.newest(), backfill);
+                    if (!stopping) {
+                        json tag;
+                        tag["gapMs"] = gap_ms;
+                        tag["events"] = gap.frames.size();
+                        if (gap.truncated) tag["truncated"] = true;
+                        std::cerr << "[BACKFILL] " << gap.frames.size() << " events after " << gap_ms << "ms"
+                                  << (gap.truncated ? " (truncated)" : "") << std::endl;
+                        cursor.begin_backfill(std::move(tag));
+                        for (const auto& frame : gap.frames) handler.handle(frame);
+                        cursor.end_backfill();
+                    }
+
+                    uint64_t dropped = 0;
+                    while (true) {
+                        {
+                            std::lock_guard<std::mutex> lock(hold_mtx);
+                            if (held.empty()) {
+                                dropped = std::exchange(held_dropped, 0);
+                                if (dropped == 0 || stopping) holding = false;
+                                held_bytes = 0;
+                                break;
+                            }
+                            pending.swap(held);
+                            held_bytes = 0;
+                        }
+                        for (const auto& frame : pending) handler.handle(frame);
+                        pending.clear();
+                    }
+                    if (dropped == 0 || stopping) return;
+                    std::cerr << "[BACKFILL] " << dropped << " live frames over max_held_kb; fetching them again"
+                              << std::endl;
+                }
             }
     };
 }
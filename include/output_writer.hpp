@@ -0,0 +1,240 @@
+#ifndef OUTPUT_WRITER
+#define OUTPUT_WRITER
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include "ring_buffer.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    struct OutputConfig {
+        int queue_size = 4096;          // lines buffered between producers and the writer
+        std::string policy = "block";   // when the consumer falls behind: "block", "drop" or "sample"
+        int sample_every = 10;          // "sample": keep 1 of N lines once the queue is half full
+        int batch_bytes = 64 * 1024;    // write as soon as this much is pending
+        int flush_ms = 10;              // ...or when the oldest pending line is this old
+    };
+
+    // Writes stdout lines from a dedicated thread
+    // Producers (the websocket callback) only copy the line into a bounded
+    // queue; the writer coalesces lines into large write(2) calls. A slow
+    // reader on the other end of the pipe then stalls this thread instead of
+    // the websocket, and `policy` decides what happens once the queue fills.
+    class OutputWriter {
+    public:
+        OutputConfig config;
+        std::string line_end = "\n"; // appended to every record ("" for length-prefixed binary)
+
+        OutputWriter() = default;
+
+        ~OutputWriter() {
+            stop();
+        }
+
+        OutputWriter(const OutputWriter&) = delete;
+        OutputWriter& operator=(const OutputWriter&) = delete;
+
+        void start() {
+            if (running) return;
+            ring = std::make_unique<RingBuffer<std::string>>(static_cast<size_t>(std::max(config.queue_size, 1)));
+            running = true;
+            thread = std::thread(&OutputWriter::loop, this);
+        }
+
+        // Write what is queued and stop the writer thread
+        void stop() {
+            if (!running.exchange(false)) return;
+            wake();
+            if (thread.joinable()) thread.join();
+        }
+
+        // Queue one line (without the trailing newline); false when `policy`
+        // discarded it. Falls back to a direct write when the writer is not running.
+        bool push(const std::string& line) {
+            if (!running) {
+                std::cout.write(line.data(), static_cast<std::streamsize>(line.size()));
+                std::cout << line_end;
+                std::cout.flush();
+                return true;
+            }
+
+            if (config.policy == "sample" && ring->size() * 2 >= ring->capacity()) {
+                if (sample_counter.fetch_add(1, std::memory_order_relaxed) % static_cast<uint64_t>(std::max(config.sample_every, 1)) != 0) {
+                    dropped++;
+                    return false;
+                }
+            }
+
+            if (!ring->try_push(line)) {
+                if (config.policy != "block") {
+                    dropped++;
+                    return false;
+                }
+                auto pause = std::chrono::microseconds(50);
+                while (!ring->try_push(line)) {
+                    if (!running) return false;
+                    wake();
+                    std::this_thread::sleep_for(pause);
+                    pause = std::min(pause * 2, std::chrono::microseconds(2000));
+                }
+                blocked++;
+            }
+
+            size_t depth = ring->size();
+            if (depth > max_depth.load(std::memory_order_relaxed)) max_depth = depth;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping.load()) wake();
+            return true;
+        }
+
+        json stats() const {
+            json j;
+            j["policy"] = config.policy;
+            j["queued"] = ring ? ring->size() : 0;
+            j["maxQueued"] = max_depth.load();
+            j["lines"] = lines.load();
+            j["bytes"] = bytes.load();
+            j["writes"] = writes.load();
+            j["dropped"] = dropped.load();
+            j["blocked"] = blocked.load();
+            return j;
+        }
+
+    private:
+        std::unique_ptr<RingBuffer<std::string>> ring;
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<bool> running{false};
+        std::atomic<bool> sleeping{false};
+        std::atomic<uint64_t> sample_counter{0};
+
+        std::atomic<size_t> max_depth{0};
+        std::atomic<uint64_t> lines{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> dropped{0};   // lines lost to "drop" or "sample"
+        std::atomic<uint64_t> blocked{0};   // pushes that had to wait ("block")
+
+        void wake() {
+            std::lock_guard<std::mutex> lock(mtx);
+            cv.notify_one();
+        }
+
+        // Sleep until a line arrives or `timeout` passes (negative: no timeout)
+        // push() sees `sleeping` and wakes us; stop() always does.
+        void wait_for_data(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(mtx);
+            sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring->size() == 0 && running) {
+                if (timeout.count() < 0) cv.wait(lock);
+                else cv.wait_for(lock, timeout);
+            }
+            sleeping = false;
+        }
+
+        bool write_out(const std::string& buf) {
+            if (buf.empty()) return true;
+#ifdef _WIN32
+            bool ok = std::fwrite(buf.data(), 1, buf.size(), stdout) == buf.size();
+            std::fflush(stdout);
+            writes++;
+#else
+            // Anything already sitting in stdio's buffer goes first
+            std::cout.flush();
+            size_t off = 0;
+            bool ok = true;
+            while (off < buf.size()) {
+                ssize_t n = ::write(STDOUT_FILENO, buf.data() + off, buf.size() - off);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    ok = false;
+                    break;
+                }
+                off += static_cast<size_t>(n);
+                writes++;
+            }
+#endif
+            bytes += buf.size();
+            return ok;
+        }
+
+        void loop() {
+            const size_t batch = static_cast<size_t>(std::max(config.batch_bytes, 1));
+            const auto flush_after = std::chrono::milliseconds(std::max(config.flush_ms, 0));
+            std::string out;
+            out.reserve(batch * 2);
+            std::string line;
+            std::chrono::steady_clock::time_point oldest;
+            uint64_t reported_drops = 0;
+            auto last_report = std::chrono::steady_clock::now();
+
+            while (true) {
+                bool stopping = !running;
+                size_t n = 0;
+                while (out.size() < batch && ring->try_pop(line)) {
+                    if (out.empty()) oldest = std::chrono::steady_clock::now();
+                    out.append(line);
+                    out += line_end;
+                    n++;
+                }
+                lines += n;
+
+                auto now = std::chrono::steady_clock::now();
+                if (!out.empty() && (out.size() >= batch || stopping || now - oldest >= flush_after)) {
+                    if (!write_out(out)) {
+                        std::cerr << "[OUT] write to stdout failed: " << strerror(errno) << std::endl;
+                    }
+                    out.clear();
+                    continue;
+                }
+                if (stopping && ring->size() == 0) break;
+
+                // Losses can't be reported on stdout itself
+                uint64_t d = dropped.load();
+                if (d != reported_drops && now - last_report >= std::chrono::seconds(1)) {
+                    std::cerr << "[OUT] consumer too slow: dropped " << d - reported_drops
+                              << " lines (policy " << config.policy << ")" << std::endl;
+                    reported_drops = d;
+                    last_report = now;
+                }
+
+                if (out.empty()) {
+                    // Idle: no timer unless a drop report is still due
+                    auto wait = std::chrono::milliseconds(-1);
+                    if (dropped.load() != reported_drops) {
+                        wait = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                            last_report + std::chrono::seconds(1) - now),
+                                        std::chrono::milliseconds(1));
+                    }
+                    wait_for_data(wait);
+                } else {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(flush_after - (now - oldest));
+                    wait_for_data(std::max(left, std::chrono::milliseconds(1)));
+                }
+            }
+        }
+    };
+
+} // namespace Misskey
+
+#endif // OUTPUT_WRITER
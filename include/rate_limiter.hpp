@@ -0,0 +1,198 @@
+#ifndef RATE_LIMITER
+#define RATE_LIMITER
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Order in which queued API requests start; lower goes first
+    enum class Priority { Interactive = 0, Normal = 1, Bulk = 2 };
+
+    inline const char* priority_name(Priority p) {
+        switch (p) {
+            case Priority::Interactive: return "interactive";
+            case Priority::Bulk: return "bulk";
+            default: return "normal";
+        }
+    }
+
+    // Posting (replies included) is what a user is waiting on; reactions,
+    // votes and follows are the bulk a bot fires off in bursts
+    inline Priority default_priority(std::string_view endpoint) {
+        if (endpoint == "notes/create" || endpoint == "drive/files/create") return Priority::Interactive;
+        if (endpoint.starts_with("notes/reactions/") || endpoint == "notes/polls/vote" ||
+            endpoint.starts_with("following/") || endpoint.starts_with("blocking/")) {
+            return Priority::Bulk;
+        }
+        return Priority::Normal;
+    }
+
+    // Endpoints that only read, so repeating one is harmless
+    // A 503 may come from a proxy after the server already acted, so only
+    // these are retried on it; anything that creates or changes state
+    // (notes/create, drive/files/create, ...) is not unless listed in
+    // RateLimitConfig::retry_503.
+    inline bool is_read_endpoint(std::string_view endpoint) {
+        if (endpoint == "i" || endpoint == "meta" || endpoint == "i/notifications" ||
+            endpoint == "notes/children" || endpoint == "notes/replies" || endpoint == "notes/reactions" ||
+            endpoint == "users/notes") {
+            return true;
+        }
+        return endpoint.ends_with("/show") || endpoint.ends_with("/list") ||
+               endpoint.ends_with("timeline") || endpoint.ends_with("/search");
+    }
+
+    struct BucketConfig {
+        double rate = 0;    // requests per second refilled; 0 = no limit
+        double burst = 10;  // bucket size: requests that may go back to back
+    };
+
+    struct RateLimitConfig {
+        BucketConfig defaults;                                   // endpoints not listed below
+        std::unordered_map<std::string, BucketConfig> endpoints; // e.g. "notes/create"
+        int max_retries = 3;        // 429/503 retries before the error is returned
+        int backoff_ms = 500;       // first retry delay without Retry-After (doubles, jittered)
+        int max_backoff_ms = 30000; // cap on any single delay, Retry-After included
+        std::unordered_set<std::string> retry_503; // non-read endpoints also retried on 503
+    };
+
+    // Per-account, per-endpoint token buckets plus the hold a 429 puts on one
+    // Misskey limits each user separately, so every `account` (an opaque id
+    // of server and token; "" for a single one) gets its own buckets, built
+    // from the same per-endpoint config. Not thread safe; AsyncEngine only
+    // calls it under its own lock.
+    class RateLimiter {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        RateLimitConfig config;
+
+        void configure(RateLimitConfig c) {
+            config = std::move(c);
+            buckets.clear();
+        }
+
+        // Earliest time a request to `endpoint` may start
+        clock::time_point ready_at(const std::string& account, const std::string& endpoint, clock::time_point now) {
+            Bucket& b = bucket(account, endpoint, now);
+            clock::time_point at = std::max(now, b.held_until);
+            if (b.config.rate > 0) {
+                refill(b, now);
+                if (b.tokens < 1) {
+                    auto wait = std::chrono::duration<double>((1 - b.tokens) / b.config.rate);
+                    at = std::max(at, now + std::chrono::duration_cast<clock::duration>(wait));
+                }
+            }
+            return at;
+        }
+
+        // Spend a token on a request that is starting now
+        void take(const std::string& account, const std::string& endpoint, clock::time_point now) {
+            Bucket& b = bucket(account, endpoint, now);
+            b.started++;
+            if (b.config.rate <= 0) return;
+            refill(b, now);
+            b.tokens -= 1;
+        }
+
+        // The server said slow down: nothing starts on `endpoint` before `until`
+        void hold(const std::string& account, const std::string& endpoint, clock::time_point until) {
+            Bucket& b = bucket(account, endpoint, clock::now());
+            b.held_until = std::max(b.held_until, until);
+            b.throttled++;
+            if (b.config.rate > 0) b.tokens = std::min(b.tokens, 0.0);
+        }
+
+        // Whether a 429/503 answer to `endpoint` may be sent again
+        // 429 means the server did nothing, so it always may.
+        bool retryable(const std::string& endpoint, long status) const {
+            if (status == 429) return true;
+            if (status != 503) return false;
+            return is_read_endpoint(endpoint) || config.retry_503.count(endpoint) > 0;
+        }
+
+        // Delay before retry number `attempt` (1-based): the server's
+        // Retry-After when it sent one, otherwise exponential backoff with
+        // jitter (50-100%) so a burst of retries spreads out
+        std::chrono::milliseconds backoff(int attempt, int retry_after_ms) {
+            int cap = std::max(config.max_backoff_ms, 1);
+            if (retry_after_ms >= 0) return std::chrono::milliseconds(std::min(retry_after_ms, cap));
+            double ceiling = std::min<double>(cap, static_cast<double>(std::max(config.backoff_ms, 1)) *
+                                                       static_cast<double>(1ULL << std::min(attempt - 1, 20)));
+            std::uniform_real_distribution<double> jitter(0.5, 1.0);
+            return std::chrono::milliseconds(static_cast<int64_t>(ceiling * jitter(rng)));
+        }
+
+        // Retry-After in milliseconds; -1 when absent or not delta-seconds
+        static int parse_retry_after(const std::string& value) {
+            if (value.empty()) return -1;
+            char* end = nullptr;
+            double seconds = std::strtod(value.c_str(), &end);
+            if (end == value.c_str() || seconds < 0) return -1;
+            return static_cast<int>(std::min(seconds * 1000.0, 1e9));
+        }
+
+        // Keyed by endpoint, "endpoint@account" for a non-default account
+        json stats() const {
+            json j = json::object();
+            for (const auto& [key, b] : buckets) {
+                json e;
+                e["started"] = b.started;
+                e["throttled"] = b.throttled;
+                if (b.config.rate > 0) {
+                    e["rate"] = b.config.rate;
+                    e["tokens"] = b.tokens;
+                }
+                j[key] = e;
+            }
+            return j;
+        }
+
+    private:
+        struct Bucket {
+            BucketConfig config;
+            double tokens = 0;
+            clock::time_point refilled;
+            clock::time_point held_until;
+            uint64_t started = 0;
+            uint64_t throttled = 0;
+        };
+
+        std::unordered_map<std::string, Bucket> buckets; // by "endpoint@account"
+        std::minstd_rand rng{std::random_device{}()};
+
+        Bucket& bucket(const std::string& account, const std::string& endpoint, clock::time_point now) {
+            std::string key = account.empty() ? endpoint : endpoint + "@" + account;
+            auto it = buckets.find(key);
+            if (it != buckets.end()) return it->second;
+            Bucket b;
+            auto cfg = config.endpoints.find(endpoint);
+            b.config = cfg != config.endpoints.end() ? cfg->second : config.defaults;
+            b.config.burst = std::max(b.config.burst, 1.0);
+            b.tokens = b.config.burst;
+            b.refilled = now;
+            return buckets.emplace(std::move(key), b).first->second;
+        }
+
+        static void refill(Bucket& b, clock::time_point now) {
+            double elapsed = std::chrono::duration<double>(now - b.refilled).count();
+            if (elapsed <= 0) return;
+            b.tokens = std::min(b.config.burst, b.tokens + elapsed * b.config.rate);
+            b.refilled = now;
+        }
+    };
+
+} // namespace Misskey
+
+#endif // RATE_LIMITER
@@ -0,0 +1,358 @@
+#ifndef RESPONSE_CACHE
+#define RESPONSE_CACHE
+
+#include <string>
+#include <string_view>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // API responses kept on disk between `what` invocations
+    // One memory-mapped file of fixed-size slots (an open-addressed hash
+    // table), shared by every process that opens it: readers take flock
+    // LOCK_SH, writers LOCK_EX, and the hit/miss counters in the header are
+    // updated atomically in place. Entries carry their store time; how old
+    // an entry may be is the reader's choice. Responses too big for a slot
+    // are simply not cached. POSIX only; open() fails on Windows.
+    class ResponseCache {
+    public:
+        int ttl_s = 300;          // default freshness for readers
+        uint32_t slots = 512;     // set before open()
+        uint32_t slot_size = 32 * 1024;
+
+        ResponseCache() = default;
+
+        ~ResponseCache() {
+            close();
+        }
+
+        ResponseCache(const ResponseCache&) = delete;
+        ResponseCache& operator=(const ResponseCache&) = delete;
+
+        // Map `file`, creating it when missing; false when it has another layout
+        bool open(const std::string& file) {
+#ifdef _WIN32
+            (void)file;
+            return false;
+#else
+            path = file;
+            fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (fd == -1) {
+                std::cerr << "[CACHE] cannot open " << file << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            slot_size = std::max<uint32_t>(slot_size, 1024);
+            slots = std::max<uint32_t>(slots, probe_window);
+            size = header_size + static_cast<size_t>(slots) * slot_size;
+
+            // Another process (a running daemon) may have this file mapped, so
+            // it is only ever sized when empty and only initialised when it has
+            // no header yet; a file laid out differently is left alone
+            flock(fd, LOCK_EX);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                std::cerr << "[CACHE] cannot stat " << file << ": " << strerror(errno) << std::endl;
+                flock(fd, LOCK_UN);
+                close();
+                return false;
+            }
+            bool fresh = st.st_size == 0;
+            if (fresh && ftruncate(fd, static_cast<off_t>(size)) == -1) {
+                std::cerr << "[CACHE] cannot size " << file << ": " << strerror(errno) << std::endl;
+                flock(fd, LOCK_UN);
+                close();
+                return false;
+            }
+            if (!fresh && static_cast<size_t>(st.st_size) != size) {
+                layout_mismatch(file);
+                flock(fd, LOCK_UN);
+                close();
+                return false;
+            }
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                std::cerr << "[CACHE] mmap failed: " << strerror(errno) << std::endl;
+                flock(fd, LOCK_UN);
+                close();
+                return false;
+            }
+            base = static_cast<char*>(p);
+            Header* h = header();
+            bool blank = std::all_of(h->magic, h->magic + sizeof(h->magic), [](char c) { return c == 0; });
+            if (blank) {
+                // A just-sized file is already zero (and sparse)
+                std::memcpy(h->magic, magic, sizeof(h->magic));
+                h->slots = slots;
+                h->slot_size = slot_size;
+            } else if (std::memcmp(h->magic, magic, sizeof(h->magic)) != 0 ||
+                       h->slots != slots || h->slot_size != slot_size) {
+                layout_mismatch(file);
+                flock(fd, LOCK_UN);
+                close();
+                return false;
+            }
+            flock(fd, LOCK_UN);
+            return true;
+#endif
+        }
+
+        void close() {
+#ifndef _WIN32
+            if (base) munmap(base, size);
+            if (fd != -1) ::close(fd);
+#endif
+            base = nullptr;
+            fd = -1;
+        }
+
+        bool is_open() const { return base != nullptr; }
+
+        // Copy of the value stored under `key` if it is at most `max_age_s` old
+        bool get(std::string_view key, int max_age_s, std::string& value) {
+            if (!base) return false;
+            uint64_t h = hash(key);
+            int64_t oldest = now_ms() - static_cast<int64_t>(max_age_s) * 1000;
+            bool found = false;
+            {
+                Lock lock(*this, false);
+                if (Slot* s = find(key, h)) {
+                    if (s->stored_ms >= oldest) {
+                        value.assign(s->value(), s->value_len);
+                        found = true;
+                    }
+                }
+            }
+            counter(found ? &Header::hits : &Header::misses).fetch_add(1);
+            return found;
+        }
+
+        // Store `value` under `key`, replacing an older copy; false when too big
+        bool put(std::string_view key, std::string_view value) {
+            if (!base || sizeof(Slot) + key.size() + value.size() > slot_size) return false;
+            uint64_t h = hash(key);
+            Lock lock(*this, true);
+
+            Slot* target = find(key, h);
+            if (!target) {
+                // Empty slot first, else the oldest entry in the window goes
+                Slot* oldest = nullptr;
+                for (uint32_t i = 0; i < probe_window; i++) {
+                    Slot* s = slot((h + i) % slots);
+                    if (s->hash == 0) {
+                        target = s;
+                        break;
+                    }
+                    if (!oldest || s->stored_ms < oldest->stored_ms) oldest = s;
+                }
+                if (!target) {
+                    target = oldest;
+                    counter(&Header::evictions).fetch_add(1);
+                }
+            }
+            target->hash = h;
+            target->stored_ms = now_ms();
+            target->key_len = static_cast<uint32_t>(key.size());
+            target->value_len = static_cast<uint32_t>(value.size());
+            std::memcpy(target->key(), key.data(), key.size());
+            std::memcpy(target->value(), value.data(), value.size());
+            counter(&Header::stores).fetch_add(1);
+            return true;
+        }
+
+        // Forget `key`; true when it was cached
+        bool invalidate(std::string_view key) {
+            if (!base) return false;
+            Lock lock(*this, true);
+            Slot* s = find(key, hash(key));
+            if (!s) return false;
+            s->hash = 0;
+            counter(&Header::invalidations).fetch_add(1);
+            return true;
+        }
+
+        // Drop every entry and reset the counters
+        void clear() {
+            if (!base) return;
+            Lock lock(*this, true);
+            for (uint32_t i = 0; i < slots; i++) {
+                if (slot(i)->hash != 0) slot(i)->hash = 0; // untouched pages stay unallocated
+            }
+            for (auto field : {&Header::hits, &Header::misses, &Header::stores,
+                               &Header::invalidations, &Header::evictions}) {
+                counter(field).store(0);
+            }
+        }
+
+        json stats() {
+            json j;
+            j["path"] = path;
+            if (!base) {
+                j["enabled"] = false;
+                return j;
+            }
+            size_t entries = 0, fresh = 0;
+            int64_t oldest = now_ms() - static_cast<int64_t>(ttl_s) * 1000;
+            {
+                Lock lock(*this, false);
+                for (uint32_t i = 0; i < slots; i++) {
+                    const Slot* s = slot(i);
+                    if (s->hash == 0) continue;
+                    entries++;
+                    if (s->stored_ms >= oldest) fresh++;
+                }
+            }
+            uint64_t hits = counter(&Header::hits).load();
+            uint64_t misses = counter(&Header::misses).load();
+            j["slots"] = slots;
+            j["slotBytes"] = slot_size;
+            j["entries"] = entries;
+            j["fresh"] = fresh;
+            j["ttlS"] = ttl_s;
+            j["hits"] = hits;
+            j["misses"] = misses;
+            j["hitRatio"] = hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0;
+            j["stores"] = counter(&Header::stores).load();
+            j["invalidations"] = counter(&Header::invalidations).load();
+            j["evictions"] = counter(&Header::evictions).load();
+            return j;
+        }
+
+    private:
+        static constexpr char magic[8] = {'W', 'H', 'A', 'T', 'C', 'A', 'C', '1'};
+        static constexpr size_t header_size = 4096;
+        static constexpr uint32_t probe_window = 8;
+
+        struct Header {
+            char magic[8];
+            uint32_t slots;
+            uint32_t slot_size;
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t stores;
+            uint64_t invalidations;
+            uint64_t evictions;
+        };
+
+        struct Slot {
+            uint64_t hash;       // 0 = empty
+            int64_t stored_ms;   // unix time
+            uint32_t key_len;
+            uint32_t value_len;
+            char* key() { return reinterpret_cast<char*>(this + 1); }
+            char* value() { return key() + key_len; }
+        };
+
+        // In-process readers/writer lock plus flock for other processes
+        // flock belongs to the open file description every thread shares, so
+        // the first reader in takes LOCK_SH and the last one out releases it;
+        // a writer holds the shared_mutex exclusively, so no reader is inside.
+        struct Lock {
+            ResponseCache& c;
+            bool exclusive;
+            Lock(ResponseCache& cache, bool excl) : c(cache), exclusive(excl) {
+                if (exclusive) {
+                    c.mtx.lock();
+#ifndef _WIN32
+                    flock(c.fd, LOCK_EX);
+#endif
+                    return;
+                }
+                c.mtx.lock_shared();
+                std::lock_guard<std::mutex> guard(c.readers_mtx);
+#ifndef _WIN32
+                if (c.readers == 0) flock(c.fd, LOCK_SH);
+#endif
+                c.readers++;
+            }
+            ~Lock() {
+                if (exclusive) {
+#ifndef _WIN32
+                    flock(c.fd, LOCK_UN);
+#endif
+                    c.mtx.unlock();
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(c.readers_mtx);
+                    c.readers--;
+#ifndef _WIN32
+                    if (c.readers == 0) flock(c.fd, LOCK_UN);
+#endif
+                }
+                c.mtx.unlock_shared();
+            }
+        };
+
+        std::string path;
+        int fd = -1;
+        char* base = nullptr;
+        size_t size = 0;
+        std::shared_mutex mtx;
+        std::mutex readers_mtx;
+        int readers = 0; // in-process readers sharing the flock
+
+        Header* header() { return reinterpret_cast<Header*>(base); }
+
+        void layout_mismatch(const std::string& file) const {
+            std::cerr << "[CACHE] " << file << " was created with other [Cache] slots/slot_kb; "
+                      << "cache disabled (delete the file while no daemon is running to recreate it)" << std::endl;
+        }
+
+        Slot* slot(uint32_t i) {
+            return reinterpret_cast<Slot*>(base + header_size + static_cast<size_t>(i) * slot_size);
+        }
+
+        std::atomic_ref<uint64_t> counter(uint64_t Header::*field) {
+            return std::atomic_ref<uint64_t>(header()->*field);
+        }
+
+        Slot* find(std::string_view key, uint64_t h) {
+            for (uint32_t i = 0; i < probe_window; i++) {
+                Slot* s = slot((h + i) % slots);
+                if (s->hash == h && s->key_len == key.size() &&
+                    sizeof(Slot) + s->key_len + s->value_len <= slot_size &&
+                    std::memcmp(s->key(), key.data(), key.size()) == 0) {
+                    return s;
+                }
+            }
+            return nullptr;
+        }
+
+        // FNV-1a; never 0, which marks an empty slot
+        static uint64_t hash(std::string_view key) {
+            uint64_t h = 1469598103934665603ULL;
+            for (unsigned char c : key) {
+                h ^= c;
+                h *= 1099511628211ULL;
+            }
+            return h ? h : 1;
+        }
+
+        static int64_t now_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    };
+
+} // namespace Misskey
+
+#endif // RESPONSE_CACHE
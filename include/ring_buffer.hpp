@@ -0,0 +1,103 @@
+#ifndef RING_BUFFER
+#define RING_BUFFER
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace Misskey {
+
+    // Bounded lock-free queue (Vyukov's sequence-per-slot design)
+    // Any number of threads may push; pops are meant for one consumer, but a
+    // producer may also pop to evict the oldest entry. All slots are allocated
+    // up front. Values are handed over by swap, so a slot keeps the buffer
+    // the consumer gave back and later pushes can reuse its capacity.
+    template <typename T>
+    class RingBuffer {
+    public:
+        explicit RingBuffer(size_t capacity)
+            : cap(capacity ? capacity : 1), slots(cap) {
+            for (size_t i = 0; i < cap; i++) {
+                slots[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+        // Copy or move `value` in; false when full
+        template <typename U>
+        bool try_push(U&& value) {
+            return try_push_with([&value](T& slot) { slot = std::forward<U>(value); });
+        }
+
+        // Claim a slot and fill it in place with fill(T&); false when full
+        // Lets callers reuse the slot's existing buffers field by field.
+        template <typename F>
+        bool try_push_with(F&& fill) {
+            size_t pos = tail.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& s = slots[pos % cap];
+                size_t seq = s.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        fill(s.value);
+                        s.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Swap the oldest value into `out`; false when empty
+        bool try_pop(T& out) {
+            size_t pos = head.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& s = slots[pos % cap];
+                size_t seq = s.seq.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                if (diff == 0) {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        using std::swap;
+                        swap(out, s.value);
+                        s.seq.store(pos + cap, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Approximate number of queued values
+        size_t size() const {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t h = head.load(std::memory_order_relaxed);
+            return t > h ? t - h : 0;
+        }
+
+        size_t capacity() const { return cap; }
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<size_t> seq{0};
+            T value{};
+        };
+
+        size_t cap;
+        std::vector<Slot> slots;
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) std::atomic<size_t> head{0};
+    };
+
+} // namespace Misskey
+
+#endif // RING_BUFFER
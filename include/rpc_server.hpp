@@ -0,0 +1,278 @@
+#ifndef RPC_SERVER
+#define RPC_SERVER
+
+#include <string>
+#include <list>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // JSON-RPC 2.0 error object
+    inline json rpc_error(const json& id, int code, const std::string& message) {
+        return json{{"jsonrpc", "2.0"}, {"id", id},
+                    {"error", {{"code", code}, {"message", message}}}};
+    }
+
+    inline json rpc_result(const json& id, json result) {
+        return json{{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}};
+    }
+
+#ifndef _WIN32
+    namespace detail {
+        // Write all of buf, retrying on short writes
+        inline bool write_all(int fd, const std::string& buf) {
+            size_t off = 0;
+            while (off < buf.size()) {
+                ssize_t n = ::send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                off += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        // Read one '\n'-terminated line; `pending` keeps bytes past the newline
+        inline bool read_line(int fd, std::string& pending, std::string& line) {
+            while (true) {
+                auto nl = pending.find('\n');
+                if (nl != std::string::npos) {
+                    line.assign(pending, 0, nl);
+                    pending.erase(0, nl + 1);
+                    return true;
+                }
+                char buf[4096];
+                ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                pending.append(buf, static_cast<size_t>(n));
+            }
+        }
+
+        inline bool make_unix_addr(const std::string& path, sockaddr_un& addr) {
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(addr.sun_path)) return false;
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+    }
+
+    // Newline-delimited JSON-RPC 2.0 server on a Unix domain socket
+    // Each client connection gets its own thread, so a slow request from one
+    // client never holds up another. Requests on one connection are answered
+    // in order.
+    class RpcServer {
+    public:
+        // Returns the JSON-RPC response for one request
+        using Handler = std::function<json(const json& request)>;
+
+        explicit RpcServer(Handler handler) : handler(std::move(handler)) {}
+
+        ~RpcServer() {
+            stop();
+        }
+
+        RpcServer(const RpcServer&) = delete;
+        RpcServer& operator=(const RpcServer&) = delete;
+
+        // Bind and listen on `path`
+        // Fails if another daemon is already answering on it; a stale socket
+        // file left by a crashed daemon is replaced.
+        bool listen(const std::string& socket_path) {
+            sockaddr_un addr;
+            if (!detail::make_unix_addr(socket_path, addr)) {
+                std::cerr << "[RPC] socket path too long: " << socket_path << std::endl;
+                return false;
+            }
+
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (probe >= 0) {
+                bool alive = ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+                ::close(probe);
+                if (alive) {
+                    std::cerr << "[RPC] a daemon is already listening on " << socket_path << std::endl;
+                    return false;
+                }
+            }
+            ::unlink(socket_path.c_str());
+
+            listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listen_fd < 0) {
+                std::cerr << "[RPC] socket() failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+
+            // Only the owner may talk to the daemon: it acts with our API token
+            mode_t old_mask = ::umask(0177);
+            int rc = ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            ::umask(old_mask);
+            if (rc != 0 || ::listen(listen_fd, 64) != 0) {
+                std::cerr << "[RPC] bind/listen on " << socket_path << " failed: "
+                          << strerror(errno) << std::endl;
+                ::close(listen_fd);
+                listen_fd = -1;
+                return false;
+            }
+
+            path = socket_path;
+            running = true;
+            return true;
+        }
+
+        // Accept connections on a background thread
+        void start() {
+            acceptor = std::thread(&RpcServer::serve, this);
+        }
+
+        // Accept connections on the calling thread until stop()
+        void serve() {
+            while (running) {
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    if (!running) break;
+                    std::cerr << "[RPC] accept() failed: " << strerror(errno) << std::endl;
+                    continue;
+                }
+                reap_finished();
+
+                std::lock_guard<std::mutex> lock(mtx);
+                auto conn = std::make_shared<Connection>();
+                conn->fd = fd;
+                conn->thread = std::thread(&RpcServer::serve_connection, this, conn);
+                connections.push_back(std::move(conn));
+            }
+        }
+
+        void stop() {
+            if (!running.exchange(false)) return;
+            ::shutdown(listen_fd, SHUT_RDWR);
+            ::close(listen_fd);
+            listen_fd = -1;
+            if (acceptor.joinable()) acceptor.join();
+
+            std::list<std::shared_ptr<Connection>> conns;
+            {
+                // Under mtx so a connection cannot close (and the number be
+                // reused) between the check and the shutdown
+                std::lock_guard<std::mutex> lock(mtx);
+                conns.swap(connections);
+                for (auto& c : conns) {
+                    if (c->fd != -1) ::shutdown(c->fd, SHUT_RDWR);
+                }
+            }
+            for (auto& c : conns) {
+                if (c->thread.joinable()) c->thread.join();
+            }
+            ::unlink(path.c_str());
+        }
+
+    private:
+        struct Connection {
+            int fd = -1;        // -1 once closed; guarded by mtx
+            std::thread thread;
+            std::atomic<bool> done{false};
+        };
+
+        Handler handler;
+        std::string path;
+        int listen_fd = -1;
+        std::atomic<bool> running{false};
+        std::thread acceptor;
+        std::mutex mtx;
+        std::list<std::shared_ptr<Connection>> connections;
+
+        void serve_connection(std::shared_ptr<Connection> conn) {
+            std::string pending, line;
+            while (detail::read_line(conn->fd, pending, line)) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+                json response;
+                try {
+                    json request = json::parse(line);
+                    if (!request.is_object() || !request.contains("method")) {
+                        response = rpc_error(request.value("id", json(nullptr)), -32600, "invalid request");
+                    } else {
+                        response = handler(request);
+                    }
+                } catch (const json::parse_error& e) {
+                    response = rpc_error(nullptr, -32700, e.what());
+                } catch (const std::exception& e) {
+                    response = rpc_error(nullptr, -32603, e.what());
+                }
+
+                std::string out = response.dump(-1, ' ', false, json::error_handler_t::replace);
+                out += '\n';
+                if (!detail::write_all(conn->fd, out)) break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                ::close(conn->fd);
+                conn->fd = -1;
+            }
+            conn->done = true;
+        }
+
+        void reap_finished() {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto it = connections.begin(); it != connections.end();) {
+                if ((*it)->done) {
+                    if ((*it)->thread.joinable()) (*it)->thread.join();
+                    it = connections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    };
+
+    // Send one request to a daemon and wait for its response
+    // Returns a null json when no daemon is listening on `socket_path`.
+    inline json rpc_call(const std::string& socket_path, const json& request) {
+        sockaddr_un addr;
+        if (!detail::make_unix_addr(socket_path, addr)) return json();
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return json();
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return json();
+        }
+
+        json response;
+        std::string pending, line;
+        if (detail::write_all(fd, request.dump() + "\n") &&
+            detail::read_line(fd, pending, line)) {
+            try {
+                response = json::parse(line);
+            } catch (...) {
+                response = rpc_error(request.value("id", json(nullptr)), -32700, "invalid response from daemon");
+            }
+        }
+        ::close(fd);
+        return response;
+    }
+#endif // !_WIN32
+
+} // namespace Misskey
+
+#endif // RPC_SERVER
@@ -0,0 +1,159 @@
+#ifndef SHUTDOWN_SIGNAL
+#define SHUTDOWN_SIGNAL
+
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mutex>
+#include <condition_variable>
+#else
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#endif
+
+namespace Misskey {
+
+    // Blocks the main thread until SIGINT/SIGTERM (Ctrl+C / console close on
+    // Windows) arrives
+    // POSIX: the handler writes the signal number to a self-pipe and wait()
+    // sleeps in poll(2) on it, so an idle process never wakes up. A second
+    // signal gets the default action, i.e. kills at once.
+    class ShutdownSignal {
+    public:
+        bool install() {
+#ifdef _WIN32
+            return SetConsoleCtrlHandler(&ShutdownSignal::on_console, TRUE) != 0;
+#else
+            int* fds = pipe_fds();
+            if (fds[0] != -1) return true;
+            if (pipe(fds) == -1) {
+                std::cerr << "[STOP] pipe() failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+            for (int i = 0; i < 2; i++) {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            }
+            struct sigaction sa;
+            std::memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = &ShutdownSignal::on_signal;
+            sa.sa_flags = SA_RESTART | SA_RESETHAND;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGINT, &sa, nullptr);
+            sigaction(SIGTERM, &sa, nullptr);
+            return true;
+#endif
+        }
+
+        // Sleep until a signal arrives (true) or `timeout` passes (false)
+        // A negative timeout waits forever.
+        bool wait(std::chrono::milliseconds timeout) {
+            if (received() != 0) return true;
+#ifdef _WIN32
+            auto& s = state();
+            std::unique_lock<std::mutex> lock(s.mtx);
+            auto got = [&s] { return s.signal.load() != 0; };
+            if (timeout.count() < 0) {
+                s.cv.wait(lock, got);
+                return true;
+            }
+            return s.cv.wait_for(lock, timeout, got);
+#else
+            struct pollfd pfd{pipe_fds()[0], POLLIN, 0};
+            int ms = timeout.count() < 0 ? -1 : static_cast<int>(timeout.count());
+            int n = poll(&pfd, 1, ms);
+            if (n <= 0) return received() != 0; // timeout or EINTR
+            unsigned char sig = 0;
+            while (read(pipe_fds()[0], &sig, 1) > 0) {
+                if (sig != 0) last_signal().store(sig);
+            }
+            return received() != 0;
+#endif
+        }
+
+        // Signal number (CTRL_* event + 1 on Windows) that asked us to stop; 0 = none yet
+        static int received() {
+#ifdef _WIN32
+            return state().signal.load();
+#else
+            return last_signal().load();
+#endif
+        }
+
+        static std::string name(int sig) {
+#ifdef _WIN32
+            switch (sig - 1) {
+                case CTRL_C_EVENT: return "CTRL_C";
+                case CTRL_BREAK_EVENT: return "CTRL_BREAK";
+                case CTRL_CLOSE_EVENT: return "CTRL_CLOSE";
+                case CTRL_SHUTDOWN_EVENT: return "CTRL_SHUTDOWN";
+                default: return std::to_string(sig);
+            }
+#else
+            if (sig == SIGINT) return "SIGINT";
+            if (sig == SIGTERM) return "SIGTERM";
+            return std::to_string(sig);
+#endif
+        }
+
+    private:
+#ifdef _WIN32
+        struct State {
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::atomic<int> signal{0};
+        };
+
+        static State& state() {
+            static State s;
+            return s;
+        }
+
+        // Runs on a thread the system creates, so a condition variable is fine
+        static BOOL WINAPI on_console(DWORD type) {
+            auto& s = state();
+            {
+                std::lock_guard<std::mutex> lock(s.mtx);
+                if (s.signal.load() != 0) return FALSE; // second time: default handling
+                s.signal = static_cast<int>(type) + 1;
+            }
+            s.cv.notify_all();
+            if (type == CTRL_CLOSE_EVENT) {
+                // Windows kills us once this returns; give the drain a moment
+                Sleep(5000);
+            }
+            return TRUE;
+        }
+#else
+        static int* pipe_fds() {
+            static int fds[2] = {-1, -1};
+            return fds;
+        }
+
+        static std::atomic<int>& last_signal() {
+            static std::atomic<int> sig{0};
+            return sig;
+        }
+
+        static void on_signal(int sig) {
+            int saved = errno;
+            last_signal().store(sig);
+            unsigned char c = static_cast<unsigned char>(sig);
+            ssize_t n = write(pipe_fds()[1], &c, 1);
+            (void)n;
+            errno = saved;
+        }
+#endif
+    };
+
+} // namespace Misskey
+
+#endif // SHUTDOWN_SIGNAL
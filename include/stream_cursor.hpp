@@ -0,0 +1,75 @@
+#ifndef STREAM_CURSOR
+#define STREAM_CURSOR
+
+#include <string>
+#include <map>
+#include <unordered_set>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Where one connection's stream got to, for backfilling after a reconnect
+    // EventHandler reports every note (timeline channels) and notification
+    // ("main") it is about to emit; the newest id per channel is the sinceId
+    // of the next backfill. Ids the backfill delivered are remembered until
+    // the following one so the same note arriving live is not emitted twice.
+    class StreamCursor {
+    public:
+        // Newest id seen per channel
+        std::map<std::string, std::string> newest() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return ids;
+        }
+
+        // Called for each note/notification about to be emitted; false when
+        // it is a live copy of one the backfill already emitted
+        bool admit(const std::string& channel, const std::string& id) {
+            if (id.empty()) return true;
+            std::lock_guard<std::mutex> lock(mtx);
+            std::string key = channel + ":" + id;
+            if (!backfilling && recovered.count(key)) return false;
+            if (backfilling) recovered.insert(key);
+            std::string& newest_id = ids[channel];
+            if (newer(id, newest_id)) newest_id = id;
+            return true;
+        }
+
+        // While set, admitted events are recorded as recovered and tagged
+        void begin_backfill(json gap) {
+            std::lock_guard<std::mutex> lock(mtx);
+            recovered.clear();
+            backfill_tag = std::move(gap);
+            backfilling = true;
+        }
+
+        void end_backfill() {
+            std::lock_guard<std::mutex> lock(mtx);
+            backfilling = false;
+        }
+
+        // The "backfilled" value for events emitted now; null when live
+        json tag() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return backfilling ? backfill_tag : json();
+        }
+
+        // Misskey ids of one server share a format and sort by time
+        static bool newer(const std::string& a, const std::string& b) {
+            if (a.size() != b.size()) return a.size() > b.size();
+            return a > b;
+        }
+
+    private:
+        mutable std::mutex mtx;
+        std::map<std::string, std::string> ids;   // channel -> newest id
+        std::unordered_set<std::string> recovered; // "channel:id" from the last backfill
+        json backfill_tag;
+        bool backfilling = false;
+    };
+
+} // namespace Misskey
+
+#endif // STREAM_CURSOR
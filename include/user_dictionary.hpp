@@ -0,0 +1,105 @@
+#ifndef USER_DICTIONARY
+#define USER_DICTIONARY
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "lru_map.hpp"
+
+using json = nlohmann::json;
+
+namespace Misskey {
+
+    // Users already sent to the consumer in compact output mode
+    // Remembers a fingerprint of each user's extracted fields so a rename is
+    // sent again. Bounded: a user evicted here is simply sent again later,
+    // so the consumer may bound its own table the same way.
+    class UserDictionary {
+    public:
+        size_t capacity = 10000;
+
+        // True when `user` (an extract_user object) must be sent: first
+        // sighting, evicted since, or any field changed. Nothing is recorded
+        // until sent() confirms the line reached the output, so a dropped
+        // line is retried and a concurrent caller sends its own copy rather
+        // than relying on one not yet written.
+        bool needs_send(const json& user, uint64_t& fp) {
+            auto id = user.find("id");
+            if (id == user.end() || !id->is_string()) return false;
+            fp = fingerprint(user);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            const uint64_t* known = users.find(id->get_ref<const std::string&>());
+            if (known && *known == fp) {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        // The "user" line for `user` (fingerprint `fp`) was queued
+        void sent(const json& user, uint64_t fp) {
+            const std::string& id = user.at("id").get_ref<const std::string&>();
+            std::lock_guard<std::mutex> lock(mtx);
+            if (uint64_t* known = users.find(id)) {
+                if (*known != fp) {
+                    *known = fp;
+                    changed.fetch_add(1, std::memory_order_relaxed);
+                }
+                return;
+            }
+            bool full = false;
+            users.insert(id, capacity, full) = fp;
+            if (full) evicted.fetch_add(1, std::memory_order_relaxed);
+            added.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        json stats() const {
+            size_t size;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                size = users.size();
+            }
+            return json{
+                {"size", size},
+                {"hits", hits.load()},
+                {"added", added.load()},
+                {"changed", changed.load()},
+                {"evicted", evicted.load()},
+            };
+        }
+
+    private:
+        mutable std::mutex mtx;
+        LruMap<uint64_t> users; // id -> fingerprint
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> added{0};
+        std::atomic<uint64_t> changed{0};
+        std::atomic<uint64_t> evicted{0};
+
+        // Hash of every field, keys included; null and "" differ
+        static uint64_t fingerprint(const json& user) {
+            uint64_t h = 1469598103934665603ULL;
+            auto mix = [&h](std::string_view s) {
+                h ^= std::hash<std::string_view>{}(s);
+                h *= 1099511628211ULL;
+            };
+            for (const auto& item : user.items()) {
+                mix(item.key());
+                const json& value = item.value();
+                if (value.is_string()) mix(value.get_ref<const std::string&>());
+                else if (value.is_null()) mix("\x01null");
+                else mix(value.dump());
+            }
+            return h;
+        }
+    };
+
+} // namespace Misskey
+
+#endif // USER_DICTIONARY
@@ -0,0 +1,442 @@
+// Mock Misskey server for offline load and latency tests
+//
+//   xmake build mock-server && xmake run mock-server [options]
+//
+// Serves the API endpoints `api` calls over plain HTTP on --port and the
+// /streaming channel protocol on --port + 1. Point the client at it with
+//
+//   [Secrets]
+//   uri = "127.0.0.1:8080"
+//   scheme = "http"
+//   streaming_uri = "127.0.0.1:8081"
+//
+// Options:
+//   --host <addr>             listen address (127.0.0.1)
+//   --port <n>                API port (8080); streaming listens on n + 1
+//   --streaming-port <n>      streaming port override
+//   --latency-ms <n>          delay added to every API response (0)
+//   --jitter-ms <n>           extra random delay, uniform in [0, n] (0)
+//   --error-rate <p>          fraction of API calls answered with a 500 (0)
+//   --events-per-sec <r>      stream events sent to each client per second (10)
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXHttpServer.h>
+#include <ixwebsocket/IXWebSocketServer.h>
+#include <nlohmann/json.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+
+using json = nlohmann::json;
+
+struct MockConfig {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int streaming_port = 0;     // 0: port + 1
+    int latency_ms = 0;
+    int jitter_ms = 0;
+    double error_rate = 0.0;
+    double events_per_sec = 10.0;
+};
+
+class MockMisskey {
+public:
+    explicit MockMisskey(MockConfig config) : config(std::move(config)) {}
+
+    // HTTP side: POST /api/<endpoint>
+    ix::HttpResponsePtr handle_http(const ix::HttpRequestPtr& request) {
+        requests++;
+        delay();
+
+        const std::string prefix = "/api/";
+        if (request->method != "POST" || request->uri.rfind(prefix, 0) != 0) {
+            return respond(404, error_body("NO_SUCH_ENDPOINT", "No such endpoint."));
+        }
+        std::string endpoint = request->uri.substr(prefix.size());
+        auto query = endpoint.find('?');
+        if (query != std::string::npos) endpoint.resize(query);
+
+        if (chance(config.error_rate)) {
+            errors++;
+            return respond(500, error_body("INTERNAL_ERROR", "Internal error occurred."));
+        }
+
+        // Uploads are multipart; everything else is a JSON body with the token
+        json body = json::object();
+        if (endpoint != "drive/files/create") {
+            try {
+                body = json::parse(request->body);
+            } catch (...) {
+                return respond(400, error_body("INVALID_PARAM", "Invalid JSON body."));
+            }
+            if (!body.is_object() || !body.contains("i")) {
+                return respond(401, error_body("CREDENTIAL_REQUIRED", "Credential required."));
+            }
+        }
+
+        int status = 200;
+        json result = api(endpoint, body, status);
+        if (status == 204) return respond(204, json());
+        return respond(status, result);
+    }
+
+    // Streaming side: track each client's channel subscriptions
+    void handle_ws(const std::shared_ptr<ix::ConnectionState>& state, ix::WebSocket& ws,
+                   const ix::WebSocketMessagePtr& msg) {
+        std::lock_guard<std::mutex> lock(clients_mtx);
+        if (msg->type == ix::WebSocketMessageType::Open) {
+            clients[state->getId()] = Client{&ws, {}};
+            std::cerr << "[MOCK] streaming client " << state->getId() << " connected" << std::endl;
+        } else if (msg->type == ix::WebSocketMessageType::Close) {
+            clients.erase(state->getId());
+            std::cerr << "[MOCK] streaming client " << state->getId() << " disconnected" << std::endl;
+        } else if (msg->type == ix::WebSocketMessageType::Message) {
+            json frame = json::parse(msg->str, nullptr, false);
+            if (frame.is_discarded() || !frame.contains("body")) return;
+            auto it = clients.find(state->getId());
+            if (it == clients.end()) return;
+            std::string type = frame.value("type", "");
+            const json& body = frame["body"];
+            if (type == "connect") {
+                it->second.channels.emplace_back(body.value("id", ""), body.value("channel", ""));
+            } else if (type == "disconnect") {
+                auto& channels = it->second.channels;
+                std::erase_if(channels, [&](const auto& c) { return c.first == body.value("id", ""); });
+            }
+        }
+    }
+
+    // Send events to every subscribed channel at events_per_sec per client
+    void generate() {
+        if (config.events_per_sec <= 0) return;
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / config.events_per_sec));
+        auto next = std::chrono::steady_clock::now();
+        uint64_t n = 0;
+        while (true) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+
+            std::lock_guard<std::mutex> lock(clients_mtx);
+            for (auto& [id, client] : clients) {
+                if (client.channels.empty()) continue;
+                const auto& [sub_id, channel] = client.channels[n % client.channels.size()];
+                client.ws->send(channel == "main" ? main_event(sub_id, n) : note_event(sub_id));
+                events_sent++;
+            }
+            n++;
+        }
+    }
+
+    void print_stats() const {
+        std::cerr << "[MOCK] requests " << requests << ", errors " << errors
+                  << ", events sent " << events_sent << std::endl;
+    }
+
+private:
+    struct Client {
+        ix::WebSocket* ws;
+        std::vector<std::pair<std::string, std::string>> channels; // subscription id, channel
+    };
+
+    MockConfig config;
+    std::mutex rng_mtx;
+    std::mt19937_64 rng{std::random_device{}()};
+    std::mutex clients_mtx;
+    std::unordered_map<std::string, Client> clients;
+    std::atomic<uint64_t> next_id{1};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> events_sent{0};
+
+    bool chance(double p) {
+        if (p <= 0) return false;
+        std::lock_guard<std::mutex> lock(rng_mtx);
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < p;
+    }
+
+    int random_below(int n) {
+        if (n <= 0) return 0;
+        std::lock_guard<std::mutex> lock(rng_mtx);
+        return std::uniform_int_distribution<int>(0, n - 1)(rng);
+    }
+
+    void delay() {
+        int ms = config.latency_ms + random_below(config.jitter_ms + 1);
+        if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    static ix::HttpResponsePtr respond(int status, const json& body) {
+        ix::WebSocketHttpHeaders headers;
+        std::string text;
+        if (!body.is_null()) {
+            headers["Content-Type"] = "application/json; charset=utf-8";
+            text = body.dump();
+        }
+        const char* description = status == 200 ? "OK" : status == 204 ? "No Content"
+                                : status == 400 ? "Bad Request" : status == 401 ? "Unauthorized"
+                                : status == 404 ? "Not Found" : "Internal Server Error";
+        return std::make_shared<ix::HttpResponse>(status, description, ix::HttpErrorCode::Ok, headers, text);
+    }
+
+    static json error_body(const std::string& code, const std::string& message) {
+        return {{"error", {{"message", message}, {"code", code}, {"id", "00000000-0000-0000-0000-000000000000"}}}};
+    }
+
+    // Misskey-style ids: fixed prefix plus a counter
+    std::string make_id(const char* prefix = "9n") {
+        std::string digits = std::to_string(next_id++);
+        return prefix + std::string(digits.size() < 8 ? 8 - digits.size() : 0, '0') + digits;
+    }
+
+    static std::string now_iso() {
+        auto now = std::chrono::system_clock::now();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+        std::time_t t = std::chrono::system_clock::to_time_t(now);
+        std::tm tm{};
+#ifdef _WIN32
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", tm.tm_year + 1900, tm.tm_mon + 1,
+                      tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(ms));
+        return buf;
+    }
+
+    json make_user(const std::string& id = "") {
+        std::string user_id = id.empty() ? "9k0000000" + std::to_string(random_below(10)) : id;
+        return {
+            {"id", user_id},
+            {"name", "Mock " + user_id},
+            {"username", "mock_" + user_id},
+            {"host", nullptr},
+            {"avatarUrl", nullptr},
+            {"isBot", false},
+            {"isCat", false},
+            {"emojis", json::object()},
+            {"onlineStatus", "unknown"},
+        };
+    }
+
+    json make_note(const std::string& text = "", const std::string& id = "") {
+        json user = make_user();
+        return {
+            {"id", id.empty() ? make_id() : id},
+            {"createdAt", now_iso()},
+            {"userId", user["id"]},
+            {"user", user},
+            {"text", text.empty() ? "mock note " + std::to_string(next_id.load()) : text},
+            {"cw", nullptr},
+            {"visibility", "public"},
+            {"localOnly", false},
+            {"renoteCount", 0},
+            {"repliesCount", 0},
+            {"reactions", json::object()},
+            {"reactionEmojis", json::object()},
+            {"fileIds", json::array()},
+            {"files", json::array()},
+            {"replyId", nullptr},
+            {"renoteId", nullptr},
+        };
+    }
+
+    // With sinceId (a backfill) only a short, not full, page is returned so
+    // the client's pagination ends
+    int page_limit(const json& body) {
+        int limit = std::clamp(body.value("limit", 10), 1, 100);
+        return body.contains("sinceId") ? random_below(limit) : limit;
+    }
+
+    // With untilId (paging back) the ids continue downwards from it and run
+    // out at the start of the mock's history
+    static std::vector<std::string> older_ids(const json& body, int limit, const char* prefix) {
+        std::vector<std::string> ids;
+        std::string until = body.value("untilId", "");
+        if (until.size() <= 2) return ids;
+        long long n = std::atoll(until.c_str() + 2);
+        for (long long id = n - 1; id > 0 && static_cast<int>(ids.size()) < limit; id--) {
+            std::string digits = std::to_string(id);
+            ids.push_back(prefix + std::string(digits.size() < 8 ? 8 - digits.size() : 0, '0') + digits);
+        }
+        return ids;
+    }
+
+    json make_notes(const json& body) {
+        int limit = page_limit(body);
+        json notes = json::array();
+        if (body.contains("untilId")) {
+            for (const auto& id : older_ids(body, limit, "9n")) notes.push_back(make_note("", id));
+            return notes;
+        }
+        for (int i = 0; i < limit; i++) notes.push_back(make_note());
+        return notes;
+    }
+
+    json make_notification() {
+        static const char* types[] = {"reaction", "reply", "renote", "follow"};
+        std::string type = types[random_below(4)];
+        json n = {{"id", make_id("9p")}, {"createdAt", now_iso()}, {"type", type}, {"user", make_user()}};
+        n["userId"] = n["user"]["id"];
+        if (type != "follow") n["note"] = make_note();
+        if (type == "reaction") n["reaction"] = "👍";
+        return n;
+    }
+
+    // Response body for one endpoint; status 204 means no body
+    json api(const std::string& endpoint, const json& body, int& status) {
+        if (endpoint == "notes/create") {
+            json note = make_note(body.value("text", ""));
+            if (body.contains("cw") && body["cw"].is_string()) note["cw"] = body["cw"];
+            if (body.contains("visibility")) note["visibility"] = body["visibility"];
+            if (body.contains("replyId")) note["replyId"] = body["replyId"];
+            if (body.contains("renoteId")) note["renoteId"] = body["renoteId"];
+            if (body.contains("fileIds")) note["fileIds"] = body["fileIds"];
+            return {{"createdNote", note}};
+        }
+        if (endpoint == "notes/show") {
+            return make_note("", body.value("noteId", ""));
+        }
+        if (endpoint == "notes/timeline" || endpoint == "notes/hybrid-timeline" ||
+            endpoint == "notes/local-timeline" || endpoint == "notes/global-timeline" ||
+            endpoint == "notes/search") {
+            return make_notes(body);
+        }
+        if (endpoint == "i/notifications") {
+            int limit = page_limit(body);
+            json list = json::array();
+            if (body.contains("untilId")) {
+                for (const auto& id : older_ids(body, limit, "9p")) {
+                    json n = make_notification();
+                    n["id"] = id;
+                    list.push_back(n);
+                }
+                return list;
+            }
+            for (int i = 0; i < limit; i++) list.push_back(make_notification());
+            return list;
+        }
+        if (endpoint == "users/show") {
+            json user = make_user();
+            if (body.contains("username")) user["username"] = body["username"];
+            if (body.contains("host")) user["host"] = body["host"];
+            return user;
+        }
+        if (endpoint == "i") {
+            return make_user("9k00000000");
+        }
+        if (endpoint == "following/create" || endpoint == "following/delete" ||
+            endpoint == "blocking/create" || endpoint == "blocking/delete") {
+            return make_user(body.value("userId", ""));
+        }
+        if (endpoint == "notes/delete" || endpoint == "notes/reactions/create" ||
+            endpoint == "notes/reactions/delete" || endpoint == "notes/polls/vote") {
+            status = 204;
+            return json();
+        }
+        if (endpoint == "drive/files/create") {
+            return {
+                {"id", make_id("9f")},
+                {"createdAt", now_iso()},
+                {"name", "upload.bin"},
+                {"type", "application/octet-stream"},
+                {"isSensitive", false},
+                {"url", "http://" + config.host + "/files/mock"},
+            };
+        }
+        status = 404;
+        return error_body("NO_SUCH_ENDPOINT", "No such endpoint.");
+    }
+
+    std::string note_event(const std::string& sub_id) {
+        json frame = {{"type", "channel"}, {"body", {{"id", sub_id}, {"type", "note"}, {"body", make_note()}}}};
+        return frame.dump();
+    }
+
+    // Mostly notifications, with mentions and follows mixed in
+    std::string main_event(const std::string& sub_id, uint64_t n) {
+        json body;
+        if (n % 10 == 3) {
+            body = {{"id", sub_id}, {"type", "mention"}, {"body", make_note("@mock hello")}};
+        } else if (n % 10 == 7) {
+            body = {{"id", sub_id}, {"type", "followed"}, {"body", make_user()}};
+        } else {
+            body = {{"id", sub_id}, {"type", "notification"}, {"body", make_notification()}};
+        }
+        return json{{"type", "channel"}, {"body", body}}.dump();
+    }
+};
+
+std::string get_flag(int argc, char* argv[], const std::string& flag, const std::string& default_val) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (argv[i] == flag) return argv[i + 1];
+    }
+    return default_val;
+}
+
+int main(int argc, char* argv[]) {
+    MockConfig config;
+    try {
+        config.host = get_flag(argc, argv, "--host", config.host);
+        config.port = std::stoi(get_flag(argc, argv, "--port", std::to_string(config.port)));
+        config.streaming_port = std::stoi(get_flag(argc, argv, "--streaming-port", "0"));
+        config.latency_ms = std::stoi(get_flag(argc, argv, "--latency-ms", "0"));
+        config.jitter_ms = std::stoi(get_flag(argc, argv, "--jitter-ms", "0"));
+        config.error_rate = std::stod(get_flag(argc, argv, "--error-rate", "0"));
+        config.events_per_sec = std::stod(get_flag(argc, argv, "--events-per-sec", "10"));
+    } catch (...) {
+        std::cerr << "Usage: mock-server [--host <addr>] [--port <n>] [--streaming-port <n>] [--latency-ms <n>]\n"
+                  << "                   [--jitter-ms <n>] [--error-rate <p>] [--events-per-sec <r>]" << std::endl;
+        return 1;
+    }
+    if (config.streaming_port == 0) config.streaming_port = config.port + 1;
+
+    ix::initNetSystem();
+    MockMisskey mock(config);
+
+    ix::HttpServer http(config.port, config.host);
+    http.setOnConnectionCallback(
+        [&mock](ix::HttpRequestPtr request, std::shared_ptr<ix::ConnectionState>) {
+            return mock.handle_http(request);
+        });
+    auto res = http.listen();
+    if (!res.first) {
+        std::cerr << "[MOCK] cannot listen on " << config.host << ":" << config.port << ": " << res.second << std::endl;
+        return 1;
+    }
+
+    ix::WebSocketServer streaming(config.streaming_port, config.host);
+    streaming.setOnClientMessageCallback(
+        [&mock](std::shared_ptr<ix::ConnectionState> state, ix::WebSocket& ws, const ix::WebSocketMessagePtr& msg) {
+            mock.handle_ws(state, ws, msg);
+        });
+    res = streaming.listen();
+    if (!res.first) {
+        std::cerr << "[MOCK] cannot listen on " << config.host << ":" << config.streaming_port << ": " << res.second << std::endl;
+        return 1;
+    }
+
+    http.start();
+    streaming.start();
+    std::cerr << "[MOCK] api on http://" << config.host << ":" << config.port
+              << ", streaming on ws://" << config.host << ":" << config.streaming_port << "/streaming" << std::endl;
+
+    std::thread generator([&mock] { mock.generate(); });
+    generator.detach();
+
+    // Periodic summary until killed
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        mock.print_stats();
+    }
+}
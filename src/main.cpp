@@ -1,12 +1,27 @@
 #include "misskey_websocket.hpp"
 #include "misskey.hpp"
 #include "event_handler.hpp"
+#include "api_dispatch.hpp"
+#include "rpc_server.hpp"
+#include "metrics_server.hpp"
+#include "frame_log.hpp"
+#include "shutdown_signal.hpp"
 #include <toml++/toml.hpp>
 #include <filesystem>
+#include <algorithm>
 #include <vector>
+#include <sstream>
+#include <future>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <thread>
+#include <chrono>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
 #else
 #include <unistd.h>
 #include <climits>
@@ -14,6 +29,23 @@
 
 using namespace Misskey;
 
+#ifdef MISSKEY_ALLOC_STATS
+// Count heap allocations per thread (see alloc_stats.hpp)
+void* operator new(std::size_t size) {
+    Misskey::thread_allocs++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
 std::string get_executable_dir() {
 #ifdef _WIN32
     std::string path(MAX_PATH, '\0');
@@ -31,13 +63,47 @@ std::string get_executable_dir() {
     return std::filesystem::path(std::move(path)).parent_path().string();
 }
 
+// One streaming connection
+struct AccountConfig {
+    std::string name;           // tags its events; "" for the single [Secrets] account
+    std::string uri;
+    std::string token;
+    std::string scheme;
+    std::string streaming_uri;
+    std::vector<std::string> channels;
+};
+
 struct AppConfig {
     std::string uri;
     std::string token;
+    std::string scheme;         // "https", or "http" for a local mock server
+    std::string streaming_uri;  // host[:port] for /streaming, defaults to uri
+    std::vector<AccountConfig> accounts; // [[Accounts]], or just [Secrets]
     std::string output_format;
+    int max_in_flight = 8;
+    RateLimitConfig rate_limits;
     toml::table raw;
 };
 
+// { rate = .., burst = .. } with `fallback` for what is left out
+BucketConfig read_bucket(const toml::table& t, BucketConfig fallback) {
+    fallback.rate = t["rate"].value_or(fallback.rate);
+    fallback.burst = t["burst"].value_or(fallback.burst);
+    return fallback;
+}
+
+// Channel names from a TOML array, or the defaults
+std::vector<std::string> read_channels(const toml::array* arr) {
+    std::vector<std::string> channels;
+    if (arr) {
+        for (const auto& v : *arr) {
+            if (auto s = v.value<std::string>()) channels.push_back(*s);
+        }
+    }
+    if (channels.empty()) channels = {"main", "hybridTimeline"};
+    return channels;
+}
+
 AppConfig load_config() {
     std::string exe_dir = get_executable_dir();
     std::filesystem::path config_path = std::filesystem::path(exe_dir) / "config.toml";
@@ -51,22 +117,90 @@ AppConfig load_config() {
     toml::table tbl = toml::parse_file(config_str);
 
     AppConfig cfg;
-    cfg.uri = tbl.at_path("Secrets.uri").ref<std::string>();
-    cfg.token = tbl.at_path("Secrets.token").ref<std::string>();
+    cfg.uri = tbl.at_path("Secrets.uri").value_or<std::string>("");
+    cfg.token = tbl.at_path("Secrets.token").value_or<std::string>("");
+    cfg.scheme = tbl.at_path("Secrets.scheme").value_or<std::string>("https");
+    cfg.streaming_uri = tbl.at_path("Secrets.streaming_uri").value_or(cfg.uri);
+
+    // [[Accounts]]: several connections multiplexed into one stream
+    if (auto* arr = tbl["Accounts"].as_array()) {
+        for (auto& node : *arr) {
+            auto* t = node.as_table();
+            if (!t) continue;
+            AccountConfig a;
+            a.uri = (*t)["uri"].value_or<std::string>("");
+            a.token = (*t)["token"].value_or<std::string>("");
+            if (a.uri.empty() || a.token.empty()) {
+                std::cerr << "Each [[Accounts]] entry needs uri and token, bye" << std::endl;
+                std::exit(1);
+            }
+            a.name = (*t)["name"].value_or(a.uri);
+            a.scheme = (*t)["scheme"].value_or(cfg.scheme);
+            a.streaming_uri = (*t)["streaming_uri"].value_or(a.uri);
+            a.channels = read_channels((*t)["channels"].as_array());
+            cfg.accounts.push_back(std::move(a));
+        }
+    }
+
+    if (cfg.uri.empty() && !cfg.accounts.empty()) {
+        // CLI commands act as the first account
+        cfg.uri = cfg.accounts[0].uri;
+        cfg.token = cfg.accounts[0].token;
+        cfg.scheme = cfg.accounts[0].scheme;
+    }
+    if (cfg.uri.empty() || cfg.token.empty()) {
+        std::cerr << "Please set [Secrets] uri and token in " << config_str << ", bye" << std::endl;
+        std::exit(1);
+    }
+    if (cfg.accounts.empty()) {
+        AccountConfig a;
+        a.uri = cfg.uri;
+        a.token = cfg.token;
+        a.scheme = cfg.scheme;
+        a.streaming_uri = cfg.streaming_uri;
+        a.channels = read_channels(tbl.at_path("Secrets.channels").as_array());
+        cfg.accounts.push_back(std::move(a));
+    }
     cfg.output_format = tbl.at_path("Output.format").value_or<std::string>("jsonl");
+    cfg.max_in_flight = tbl.at_path("Http.max_in_flight").value_or(8);
+
+    // [RateLimit]: token bucket per endpoint, 429/503 retries
+    RateLimitConfig& rl = cfg.rate_limits;
+    if (auto* t = tbl["RateLimit"].as_table()) rl.defaults = read_bucket(*t, rl.defaults);
+    rl.max_retries = tbl.at_path("RateLimit.max_retries").value_or(rl.max_retries);
+    rl.backoff_ms = tbl.at_path("RateLimit.backoff_ms").value_or(rl.backoff_ms);
+    rl.max_backoff_ms = tbl.at_path("RateLimit.max_backoff_ms").value_or(rl.max_backoff_ms);
+    if (auto* arr = tbl.at_path("RateLimit.retry_503").as_array()) {
+        for (const auto& v : *arr) {
+            if (auto s = v.value<std::string>()) rl.retry_503.insert(*s);
+        }
+    }
+    if (auto* endpoints = tbl.at_path("RateLimit.endpoints").as_table()) {
+        for (auto&& [endpoint, node] : *endpoints) {
+            if (auto* t = node.as_table()) {
+                rl.endpoints[std::string(endpoint.str())] = read_bucket(*t, rl.defaults);
+            }
+        }
+    }
     cfg.raw = std::move(tbl);
     return cfg;
 }
 
 // Print JSON result to stdout
-void print_result(const json& result) {
-    std::cout << result.dump(2, ' ', false, json::error_handler_t::replace) << std::endl;
+void print_result(std::ostream& out, const json& result) {
+    out << result.dump(2, ' ', false, json::error_handler_t::replace) << std::endl;
 }
 
-void print_usage() {
-    std::cerr
+void print_usage(std::ostream& err = std::cerr) {
+    err
         << "Usage:\n"
         << "  what stream                        -- Stream timeline & notifications\n"
+        << "  what record <file> [--gzip]        -- Stream and save every raw frame to <file>\n"
+        << "  what replay <file> [--speed 1x|10x|max]\n"
+        << "                                     -- Feed a recording through the stream pipeline\n"
+        << "  what batch [--concurrency N]       -- Run JSONL commands from stdin, one result per line\n"
+        << "  what daemon [--no-stream] [--socket <path>]\n"
+        << "                                     -- Serve commands over a Unix socket (and stream)\n"
         << "  what post <text> [--cw <cw>] [--visibility <vis>] [--reply <noteId>] [--quote <noteId>]\n"
         << "       [--poll <choice1,choice2,...>] [--poll-multiple] [--poll-expires <minutes>]\n"
         << "  what reply <noteId> <text> [--cw <cw>] [--visibility <vis>]\n"
@@ -76,19 +210,27 @@ void print_usage() {
         << "  what post-image <file> [<text>] [--cw <cw>] [--visibility <vis>] [--nsfw]\n"
         << "       [--reply <noteId>] [--quote <noteId>] [--visible-user-ids <id1,id2,...>]\n"
         << "  what delete <noteId>\n"
-        << "  what show <noteId>\n"
-        << "  what timeline [hybrid|local|global|home] [--limit N]\n"
-        << "  what search <query> [--limit N]\n"
+        << "  what show <noteId> [<noteId>...]\n"
+        << "  what timeline [hybrid|local|global|home] [--limit N | --all | --max N]\n"
+        << "  what search <query> [--limit N | --all | --max N]\n"
         << "  what react <noteId> <reaction>\n"
         << "  what unreact <noteId>\n"
         << "  what vote <noteId> <choiceIndex>\n"
-        << "  what notif [--limit N]\n"
+        << "  what notif [--limit N | --all | --max N]\n"
         << "  what user <username> [--host <host>]\n"
         << "  what me\n"
         << "  what follow <userId>\n"
         << "  what unfollow <userId>\n"
         << "  what block <userId>\n"
-        << "  what unblock <userId>\n";
+        << "  what unblock <userId>\n"
+        << "  what cache stats|clear             -- Response cache hit ratio and entries / empty it\n"
+        << "\n"
+        << "Options:\n"
+        << "  --http-stats                       -- Print connection reuse counters to stderr\n"
+        << "  --no-cache                         -- show/user/me: always ask the server\n"
+        << "  --max-age <seconds>                -- show/user/me: accept cached answers up to this old\n"
+        << "  --all, --max N                     -- timeline/notif/search: page through everything (or N)\n"
+        << "                                        with untilId, one compact JSON line per item\n";
 }
 
 // Simple arg parser helpers
@@ -123,139 +265,152 @@ std::vector<std::string> positional(const std::vector<std::string>& args) {
     return result;
 }
 
-int cmd_stream(const AppConfig& cfg) {
-    EventHandler handler;
-    if (cfg.output_format == "human") {
-        handler.format = OutputFormat::Human;
-    } else {
-        handler.format = OutputFormat::JSONL;
-    }
-
-    handler.command.config.enabled =
-        cfg.raw.at_path("Command.enabled").value_or(false);
-    handler.command.config.program =
-        cfg.raw.at_path("Command.program").value_or<std::string>("");
-
-    if (auto* arr = cfg.raw.at_path("Command.args").as_array()) {
-        for (const auto& v : *arr) {
-            if (auto s = v.value<std::string>())
-                handler.command.config.args.push_back(*s);
+// Parse comma-separated --visible-user-ids flag
+std::vector<std::string> parse_visible_user_ids(const std::vector<std::string>& args) {
+    std::string raw;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--visible-user-ids" && i + 1 < args.size()) {
+            raw = args[i + 1];
+            break;
         }
     }
-    if (auto* arr = cfg.raw.at_path("Command.events").as_array()) {
-        for (const auto& v : *arr) {
-            if (auto s = v.value<std::string>())
-                handler.command.config.events.push_back(*s);
-        }
+    std::vector<std::string> ids;
+    if (raw.empty()) return ids;
+    size_t start = 0;
+    while (start < raw.size()) {
+        auto pos = raw.find(',', start);
+        if (pos == std::string::npos) pos = raw.size();
+        std::string id = raw.substr(start, pos - start);
+        if (!id.empty()) ids.push_back(id);
+        start = pos + 1;
     }
-    handler.command.config.max_queue_size =
-        cfg.raw.at_path("Command.max_queue_size").value_or(100);
-
-    handler.start();
-
-    websocket client(handler);
-    client.connect(cfg.uri, cfg.token);
-    return 0;
+    return ids;
 }
 
-int main(int argc, char* argv[]) {
-#ifdef _WIN32
-    std::setlocale(LC_ALL, ".UTF8");
-#else
-    std::setlocale(LC_ALL, "");
-#endif
+// Parse --poll flag: comma-separated choices
+json parse_poll(const std::vector<std::string>& args) {
+    std::string raw;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--poll" && i + 1 < args.size()) {
+            raw = args[i + 1];
+            break;
+        }
+    }
+    if (raw.empty()) return json();
+
+    // Parse choices
+    std::vector<std::string> choices;
+    size_t start = 0;
+    while (start < raw.size()) {
+        auto p = raw.find(',', start);
+        if (p == std::string::npos) p = raw.size();
+        std::string c = raw.substr(start, p - start);
+        if (!c.empty()) choices.push_back(c);
+        start = p + 1;
+    }
+    if (choices.size() < 2) return json();
 
-    AppConfig cfg = load_config();
-    api client(cfg.uri, cfg.token);
+    json poll;
+    poll["choices"] = choices;
 
-    // Collect args
-    std::vector<std::string> args;
-    for (int i = 1; i < argc; i++) {
-        args.emplace_back(argv[i]);
+    // Check --poll-multiple flag
+    for (const auto& a : args) {
+        if (a == "--poll-multiple") {
+            poll["multiple"] = true;
+            break;
+        }
     }
 
-    // Default: stream if no args
-    if (args.empty() || args[0] == "stream") {
-        return cmd_stream(cfg);
+    // Check --poll-expires <minutes>
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--poll-expires" && i + 1 < args.size()) {
+            try {
+                int minutes = std::stoi(args[i + 1]);
+                poll["expiredAfter"] = minutes * 60 * 1000; // convert to ms
+            } catch (...) {}
+            break;
+        }
     }
 
-    std::string cmd = args[0];
-    std::vector<std::string> rest(args.begin() + 1, args.end());
-    auto pos = positional(rest);
+    return poll;
+}
 
-    // Parse comma-separated --visible-user-ids flag
-    auto parse_visible_user_ids = [](const std::vector<std::string>& args) -> std::vector<std::string> {
-        std::string raw;
-        for (size_t i = 0; i < args.size(); i++) {
-            if (args[i] == "--visible-user-ids" && i + 1 < args.size()) {
-                raw = args[i + 1];
-                break;
-            }
-        }
-        std::vector<std::string> ids;
-        if (raw.empty()) return ids;
-        size_t start = 0;
-        while (start < raw.size()) {
-            auto pos = raw.find(',', start);
-            if (pos == std::string::npos) pos = raw.size();
-            std::string id = raw.substr(start, pos - start);
-            if (!id.empty()) ids.push_back(id);
-            start = pos + 1;
-        }
-        return ids;
+// Page through a list endpoint with untilId, one compact JSON line per item
+// The next page is requested before the current one is written, so the
+// network and the consumer overlap and at most two pages are ever held.
+// max <= 0 means until the server runs out.
+int write_all_pages(const api& client, const std::string& endpoint, const json& body, long long max,
+                    json (*extract)(const json&), std::ostream& out, std::ostream& err) {
+    long long received = 0, written = 0;
+    auto fetch = [&](const std::string& until_id) {
+        json page_body = body;
+        page_body["limit"] = max > 0 ? std::min<long long>(100, max - received) : 100;
+        if (!until_id.empty()) page_body["untilId"] = until_id;
+        return client.post_async(endpoint, std::move(page_body));
     };
 
-    // Parse --poll flag: comma-separated choices
-    auto parse_poll = [](const std::vector<std::string>& args) -> json {
-        std::string raw;
-        for (size_t i = 0; i < args.size(); i++) {
-            if (args[i] == "--poll" && i + 1 < args.size()) {
-                raw = args[i + 1];
-                break;
-            }
+    std::future<json> next = fetch("");
+    while (true) {
+        json page = next.get();
+        if (!page.is_array()) {
+            err << page.dump() << std::endl;
+            return 1;
         }
-        if (raw.empty()) return json();
-
-        // Parse choices
-        std::vector<std::string> choices;
-        size_t start = 0;
-        while (start < raw.size()) {
-            auto p = raw.find(',', start);
-            if (p == std::string::npos) p = raw.size();
-            std::string c = raw.substr(start, p - start);
-            if (!c.empty()) choices.push_back(c);
-            start = p + 1;
+        if (page.empty()) break;
+        received += static_cast<long long>(page.size());
+        std::string until_id = page.back().value("id", "");
+        bool more = (max <= 0 || received < max) && !until_id.empty();
+        if (more) next = fetch(until_id);
+
+        for (const auto& item : page) {
+            if (max > 0 && written >= max) break;
+            out << extract(item).dump(-1, ' ', false, json::error_handler_t::replace) << '\n';
+            written++;
         }
-        if (choices.size() < 2) return json();
-
-        json poll;
-        poll["choices"] = choices;
+        out.flush();
+        if (!more) break;
+    }
+    return 0;
+}
 
-        // Check --poll-multiple flag
-        for (const auto& a : args) {
-            if (a == "--poll-multiple") {
-                poll["multiple"] = true;
-                break;
-            }
-        }
+// --all / --max: output that must stream to the caller, so it never goes
+// through the daemon (an RPC reply is one buffered string)
+bool pages_output(const std::vector<std::string>& args) {
+    return std::find(args.begin(), args.end(), "--all") != args.end() ||
+           std::find(args.begin(), args.end(), "--max") != args.end();
+}
 
-        // Check --poll-expires <minutes>
-        for (size_t i = 0; i < args.size(); i++) {
-            if (args[i] == "--poll-expires" && i + 1 < args.size()) {
-                try {
-                    int minutes = std::stoi(args[i + 1]);
-                    poll["expiredAfter"] = minutes * 60 * 1000; // convert to ms
-                } catch (...) {}
-                break;
+// Run one CLI subcommand (anything but stream/daemon/batch)
+// Output goes to `out` / `err` so the daemon can capture it for RPC clients.
+int run_command(const api& shared_client, const std::string& cmd,
+                const std::vector<std::string>& args,
+                std::ostream& out, std::ostream& err) {
+    // Cache overrides apply to this command only (the copy shares the engine)
+    api client = shared_client;
+    std::vector<std::string> rest;
+    bool all_pages = false; // timeline/notif/search --all
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--all") {
+            all_pages = true;
+        } else if (args[i] == "--no-cache") {
+            client.cache_max_age_s = 0;
+        } else if (args[i] == "--max-age" && i + 1 < args.size()) {
+            try { client.cache_max_age_s = std::max(std::stoi(args[++i]), 0); } catch (...) {
+                err << "Invalid --max-age: " << args[i] << std::endl;
+                return 1;
             }
+        } else {
+            rest.push_back(args[i]);
         }
-
-        return poll;
-    };
+    }
+    auto pos = positional(rest);
+    // --all / --max N: page through everything as JSONL instead of one page
+    long long max_items = get_flag_int(rest, "--max", 0);
+    bool paginate = all_pages || max_items > 0;
 
     if (cmd == "post") {
         if (pos.empty()) {
-            std::cerr << "Usage: what post <text> [--cw <cw>] [--visibility <vis>] [--reply <noteId>] [--quote <noteId>] [--visible-user-ids <id1,id2,...>] [--poll <c1,c2,...>] [--poll-multiple] [--poll-expires <min>]" << std::endl;
+            err << "Usage: what post <text> [--cw <cw>] [--visibility <vis>] [--reply <noteId>] [--quote <noteId>] [--visible-user-ids <id1,id2,...>] [--poll <c1,c2,...>] [--poll-multiple] [--poll-expires <min>]" << std::endl;
             return 1;
         }
         std::string text = pos[0];
@@ -265,35 +420,35 @@ int main(int argc, char* argv[]) {
         std::string quote_id = get_flag(rest, "--quote");
         auto vuids = parse_visible_user_ids(rest);
         auto poll = parse_poll(rest);
-        print_result(client.note_create(text, vis, cw, reply_id, quote_id, vuids, poll));
+        print_result(out, client.note_create(text, vis, cw, reply_id, quote_id, vuids, poll));
 
     } else if (cmd == "reply") {
-        if (pos.size() < 2) { std::cerr << "Usage: what reply <noteId> <text> [--cw <cw>] [--visibility <vis>] [--visible-user-ids <id1,id2,...>]" << std::endl; return 1; }
+        if (pos.size() < 2) { err << "Usage: what reply <noteId> <text> [--cw <cw>] [--visibility <vis>] [--visible-user-ids <id1,id2,...>]" << std::endl; return 1; }
         std::string cw = get_flag(rest, "--cw");
         std::string vis = get_flag(rest, "--visibility", "public");
         auto vuids = parse_visible_user_ids(rest);
-        print_result(client.note_create(pos[1], vis, cw, pos[0], "", vuids));
+        print_result(out, client.note_create(pos[1], vis, cw, pos[0], "", vuids));
 
     } else if (cmd == "quote") {
-        if (pos.size() < 2) { std::cerr << "Usage: what quote <noteId> <text> [--cw <cw>] [--visibility <vis>]" << std::endl; return 1; }
+        if (pos.size() < 2) { err << "Usage: what quote <noteId> <text> [--cw <cw>] [--visibility <vis>]" << std::endl; return 1; }
         std::string cw = get_flag(rest, "--cw");
         std::string vis = get_flag(rest, "--visibility", "public");
-        print_result(client.note_create(pos[1], vis, cw, "", pos[0]));
+        print_result(out, client.note_create(pos[1], vis, cw, "", pos[0]));
 
     } else if (cmd == "renote" || cmd == "rn") {
-        if (pos.empty()) { std::cerr << "Usage: what renote <noteId>" << std::endl; return 1; }
-        print_result(client.renote(pos[0]));
+        if (pos.empty()) { err << "Usage: what renote <noteId>" << std::endl; return 1; }
+        print_result(out, client.renote(pos[0]));
 
     } else if (cmd == "upload") {
-        if (pos.empty()) { std::cerr << "Usage: what upload <file> [--name <name>] [--folder <folderId>] [--nsfw]" << std::endl; return 1; }
+        if (pos.empty()) { err << "Usage: what upload <file> [--name <name>] [--folder <folderId>] [--nsfw]" << std::endl; return 1; }
         std::string name = get_flag(rest, "--name");
         std::string folder = get_flag(rest, "--folder");
         bool nsfw = false;
         for (const auto& a : rest) { if (a == "--nsfw") { nsfw = true; break; } }
-        print_result(client.drive_upload(pos[0], name, folder, nsfw));
+        print_result(out, client.drive_upload(pos[0], name, folder, nsfw));
 
     } else if (cmd == "post-image" || cmd == "pi") {
-        if (pos.empty()) { std::cerr << "Usage: what post-image <file> [<text>] [--cw <cw>] [--visibility <vis>] [--nsfw]" << std::endl; return 1; }
+        if (pos.empty()) { err << "Usage: what post-image <file> [<text>] [--cw <cw>] [--visibility <vis>] [--nsfw]" << std::endl; return 1; }
         std::string file_path = pos[0];
         std::string text = pos.size() >= 2 ? pos[1] : "";
         std::string cw = get_flag(rest, "--cw");
@@ -304,88 +459,562 @@ int main(int argc, char* argv[]) {
         // Upload file first
         json upload_result = client.drive_upload(file_path, "", "", nsfw);
         if (upload_result.contains("error")) {
-            std::cerr << "Upload failed: " << upload_result.dump() << std::endl;
+            err << "Upload failed: " << upload_result.dump() << std::endl;
             return 1;
         }
         std::string file_id = upload_result.value("id", "");
         if (file_id.empty()) {
-            std::cerr << "Upload succeeded but no file ID returned" << std::endl;
+            err << "Upload succeeded but no file ID returned" << std::endl;
             return 1;
         }
 
         std::string reply_id = get_flag(rest, "--reply");
         std::string quote_id = get_flag(rest, "--quote");
         auto vuids = parse_visible_user_ids(rest);
-        print_result(client.note_create_with_files(text, {file_id}, vis, cw, reply_id, quote_id, vuids));
+        print_result(out, client.note_create_with_files(text, {file_id}, vis, cw, reply_id, quote_id, vuids));
 
     } else if (cmd == "delete") {
-        if (pos.empty()) { std::cerr << "Usage: what delete <noteId>" << std::endl; return 1; }
-        print_result(client.note_delete(pos[0]));
+        if (pos.empty()) { err << "Usage: what delete <noteId>" << std::endl; return 1; }
+        print_result(out, client.note_delete(pos[0]));
 
     } else if (cmd == "show") {
-        if (pos.empty()) { std::cerr << "Usage: what show <noteId>" << std::endl; return 1; }
-        print_result(client.note_show(pos[0]));
+        if (pos.empty()) { err << "Usage: what show <noteId> [<noteId>...]" << std::endl; return 1; }
+        if (pos.size() == 1) {
+            print_result(out, client.note_show(pos[0]));
+        } else {
+            // Fetch all notes concurrently, print in argument order
+            std::vector<std::future<json>> pending;
+            for (const auto& id : pos) pending.push_back(client.note_show_async(id));
+            json results = json::array();
+            for (auto& f : pending) results.push_back(f.get());
+            print_result(out, results);
+        }
 
     } else if (cmd == "timeline" || cmd == "tl") {
         std::string type = pos.empty() ? "hybrid" : pos[0];
+        if (paginate) {
+            return write_all_pages(client, api::timeline_endpoint(type), json::object(), max_items,
+                                   extract_note, out, err);
+        }
         int limit = get_flag_int(rest, "--limit", 10);
-        print_result(client.timeline(type, limit));
+        print_result(out, client.timeline(type, limit));
 
     } else if (cmd == "search") {
-        if (pos.empty()) { std::cerr << "Usage: what search <query>" << std::endl; return 1; }
+        if (pos.empty()) { err << "Usage: what search <query> [--limit N | --all | --max N]" << std::endl; return 1; }
+        if (paginate) {
+            return write_all_pages(client, "notes/search", {{"query", pos[0]}}, max_items,
+                                   extract_note, out, err);
+        }
         int limit = get_flag_int(rest, "--limit", 10);
-        print_result(client.search_notes(pos[0], limit));
+        print_result(out, client.search_notes(pos[0], limit));
 
     } else if (cmd == "react") {
-        if (pos.size() < 2) { std::cerr << "Usage: what react <noteId> <reaction>" << std::endl; return 1; }
-        print_result(client.reaction_create(pos[0], pos[1]));
+        if (pos.size() < 2) { err << "Usage: what react <noteId> <reaction>" << std::endl; return 1; }
+        print_result(out, client.reaction_create(pos[0], pos[1]));
 
     } else if (cmd == "unreact") {
-        if (pos.empty()) { std::cerr << "Usage: what unreact <noteId>" << std::endl; return 1; }
-        print_result(client.reaction_delete(pos[0]));
+        if (pos.empty()) { err << "Usage: what unreact <noteId>" << std::endl; return 1; }
+        print_result(out, client.reaction_delete(pos[0]));
 
     } else if (cmd == "notif" || cmd == "notifications") {
+        if (paginate) {
+            return write_all_pages(client, "i/notifications", json::object(), max_items,
+                                   extract_notification, out, err);
+        }
         int limit = get_flag_int(rest, "--limit", 10);
-        print_result(client.notifications(limit));
+        print_result(out, client.notifications(limit));
 
     } else if (cmd == "user") {
-        if (pos.empty()) { std::cerr << "Usage: what user <username> [--host <host>]" << std::endl; return 1; }
+        if (pos.empty()) { err << "Usage: what user <username> [--host <host>]" << std::endl; return 1; }
         std::string host = get_flag(rest, "--host");
-        print_result(client.user_show(pos[0], host));
+        print_result(out, client.user_show(pos[0], host));
 
     } else if (cmd == "me") {
-        print_result(client.me());
+        print_result(out, client.me());
 
     } else if (cmd == "follow") {
-        if (pos.empty()) { std::cerr << "Usage: what follow <userId>" << std::endl; return 1; }
-        print_result(client.follow(pos[0]));
+        if (pos.empty()) { err << "Usage: what follow <userId>" << std::endl; return 1; }
+        print_result(out, client.follow(pos[0]));
 
     } else if (cmd == "unfollow") {
-        if (pos.empty()) { std::cerr << "Usage: what unfollow <userId>" << std::endl; return 1; }
-        print_result(client.unfollow(pos[0]));
+        if (pos.empty()) { err << "Usage: what unfollow <userId>" << std::endl; return 1; }
+        print_result(out, client.unfollow(pos[0]));
 
     } else if (cmd == "block") {
-        if (pos.empty()) { std::cerr << "Usage: what block <userId>" << std::endl; return 1; }
-        print_result(client.block(pos[0]));
+        if (pos.empty()) { err << "Usage: what block <userId>" << std::endl; return 1; }
+        print_result(out, client.block(pos[0]));
 
     } else if (cmd == "unblock") {
-        if (pos.empty()) { std::cerr << "Usage: what unblock <userId>" << std::endl; return 1; }
-        print_result(client.unblock(pos[0]));
+        if (pos.empty()) { err << "Usage: what unblock <userId>" << std::endl; return 1; }
+        print_result(out, client.unblock(pos[0]));
 
     } else if (cmd == "vote") {
-        if (pos.size() < 2) { std::cerr << "Usage: what vote <noteId> <choiceIndex>" << std::endl; return 1; }
+        if (pos.size() < 2) { err << "Usage: what vote <noteId> <choiceIndex>" << std::endl; return 1; }
         int choice = 0;
         try { choice = std::stoi(pos[1]); } catch (...) {
-            std::cerr << "Invalid choice index: " << pos[1] << std::endl;
+            err << "Invalid choice index: " << pos[1] << std::endl;
+            return 1;
+        }
+        print_result(out, client.poll_vote(pos[0], choice));
+
+    } else if (cmd == "cache") {
+        std::string action = pos.empty() ? "stats" : pos[0];
+        if (!client.cache) {
+            err << "The response cache is off ([Cache] enabled = false)" << std::endl;
+            return 1;
+        }
+        if (action == "stats") {
+            print_result(out, client.cache->stats());
+        } else if (action == "clear") {
+            client.cache->clear();
+            print_result(out, client.cache->stats());
+        } else {
+            err << "Usage: what cache stats|clear" << std::endl;
             return 1;
         }
-        print_result(client.poll_vote(pos[0], choice));
 
     } else {
-        std::cerr << "Unknown command: " << cmd << std::endl;
-        print_usage();
+        err << "Unknown command: " << cmd << std::endl;
+        print_usage(err);
+        return 1;
+    }
+
+    return 0;
+}
+
+OutputFormat parse_format(const std::string& name) {
+    if (name == "human") return OutputFormat::Human;
+    if (name == "msgpack") return OutputFormat::MsgPack;
+    if (name == "cbor") return OutputFormat::CBOR;
+    return OutputFormat::JSONL;
+}
+
+// Apply [Output] and [Command] settings to a handler
+void setup_handler(const AppConfig& cfg, EventHandler& handler) {
+    handler.format = parse_format(cfg.output_format);
+    handler.command_format =
+        parse_format(cfg.raw.at_path("Command.format").value_or<std::string>("jsonl"));
+    if (handler.command_format == OutputFormat::Human) handler.command_format = OutputFormat::JSONL;
+#ifdef _WIN32
+    // Binary records must not go through newline translation
+    if (handler.format == OutputFormat::MsgPack || handler.format == OutputFormat::CBOR) {
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+
+    handler.command.config.enabled =
+        cfg.raw.at_path("Command.enabled").value_or(false);
+    handler.command.config.program =
+        cfg.raw.at_path("Command.program").value_or<std::string>("");
+
+    if (auto* arr = cfg.raw.at_path("Command.args").as_array()) {
+        for (const auto& v : *arr) {
+            if (auto s = v.value<std::string>())
+                handler.command.config.args.push_back(*s);
+        }
+    }
+    if (auto* arr = cfg.raw.at_path("Command.events").as_array()) {
+        for (const auto& v : *arr) {
+            if (auto s = v.value<std::string>())
+                handler.command.config.events.push_back(*s);
+        }
+    }
+    handler.command.config.max_queue_size =
+        cfg.raw.at_path("Command.max_queue_size").value_or(100);
+    handler.command.config.mode =
+        cfg.raw.at_path("Command.mode").value_or<std::string>("spawn");
+    handler.command.config.workers =
+        cfg.raw.at_path("Command.workers").value_or(1);
+    handler.command.config.timeout_ms =
+        cfg.raw.at_path("Command.timeout_ms").value_or(10000);
+    handler.command.config.order_key =
+        cfg.raw.at_path("Command.order_key").value_or<std::string>("");
+    handler.command.config.overflow =
+        cfg.raw.at_path("Command.overflow").value_or<std::string>("drop_oldest");
+    handler.command.config.block_timeout_ms =
+        cfg.raw.at_path("Command.block_timeout_ms").value_or(100);
+    handler.command.config.spill_path =
+        cfg.raw.at_path("Command.spill_path").value_or<std::string>("command_spill.jsonl");
+    handler.command.config.shutdown_timeout_ms =
+        cfg.raw.at_path("Command.shutdown_timeout_ms").value_or(5000);
+    handler.command.config.shutdown_leftover =
+        cfg.raw.at_path("Command.shutdown_leftover").value_or<std::string>("spill");
+
+    handler.output.config.queue_size =
+        cfg.raw.at_path("Output.queue_size").value_or(4096);
+    handler.output.config.policy =
+        cfg.raw.at_path("Output.policy").value_or<std::string>("block");
+    handler.output.config.sample_every =
+        cfg.raw.at_path("Output.sample_every").value_or(10);
+    handler.output.config.batch_bytes =
+        cfg.raw.at_path("Output.batch_bytes").value_or(64 * 1024);
+    handler.output.config.flush_ms =
+        cfg.raw.at_path("Output.flush_ms").value_or(10);
+    handler.compact =
+        cfg.raw.at_path("Output.compact").value_or(false);
+    handler.users.capacity =
+        static_cast<size_t>(cfg.raw.at_path("Output.user_cache").value_or(10000));
+
+    handler.stats_interval_s =
+        cfg.raw.at_path("Metrics.interval_s").value_or(0);
+
+    handler.dedup.config.enabled =
+        cfg.raw.at_path("Dedup.enabled").value_or(false);
+    handler.dedup.config.capacity =
+        static_cast<size_t>(cfg.raw.at_path("Dedup.capacity").value_or(10000));
+    handler.dedup.config.window_s =
+        cfg.raw.at_path("Dedup.window_s").value_or(600);
+    if (auto* arr = cfg.raw.at_path("Dedup.prefer").as_array()) {
+        for (const auto& v : *arr) {
+            if (auto s = v.value<std::string>())
+                handler.dedup.config.prefer.push_back(*s);
+        }
+    }
+    handler.dedup.config.on_duplicate =
+        cfg.raw.at_path("Dedup.on_duplicate").value_or<std::string>("drop");
+    handler.dedup.config.merge =
+        cfg.raw.at_path("Dedup.merge").value_or(false);
+
+    std::string filter = cfg.raw.at_path("Filter.expression").value_or<std::string>("");
+    try {
+        handler.filter = EventFilter::compile(filter);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Invalid [Filter] expression: " << e.what() << std::endl;
+        std::exit(1);
+    }
+}
+
+int cmd_stream(const AppConfig& cfg, FrameLogWriter* recorder = nullptr) {
+    // Process-wide: whichever thread takes the signal only writes a pipe
+    ShutdownSignal stop_signal;
+    stop_signal.install();
+
+    EventHandler handler;
+    setup_handler(cfg, handler);
+    handler.start();
+
+#ifndef _WIN32
+    // Prometheus endpoint ([Metrics] listen = "127.0.0.1:9464" or "unix:/path")
+    MetricsServer metrics_server([&handler] { return handler.prometheus(); });
+    std::string metrics_listen = cfg.raw.at_path("Metrics.listen").value_or<std::string>("");
+    if (!metrics_listen.empty() && metrics_server.listen(metrics_listen)) {
+        std::cerr << "[METRICS] serving on " << metrics_listen << std::endl;
+    }
+#endif
+
+    // Gap backfill after a reconnect ([Backfill]); the per-account api
+    // copies share one connection pool and in-flight limit
+    BackfillConfig backfill;
+    backfill.enabled = cfg.raw.at_path("Backfill.enabled").value_or(true);
+    backfill.page_size = cfg.raw.at_path("Backfill.page_size").value_or(100);
+    backfill.max_pages = cfg.raw.at_path("Backfill.max_pages").value_or(10);
+    backfill.max_held_bytes =
+        static_cast<size_t>(std::max(cfg.raw.at_path("Backfill.max_held_kb").value_or(16 * 1024), 1)) * 1024;
+    std::unique_ptr<api> backfill_api;
+    std::vector<std::unique_ptr<api>> account_apis;
+    if (backfill.enabled) {
+        backfill_api = std::make_unique<api>(cfg.uri, cfg.token, cfg.max_in_flight);
+        backfill_api->set_rate_limits(cfg.rate_limits);
+    }
+
+    // One connection per account, all feeding the same handler, output
+    // writer and command pool
+    std::vector<std::unique_ptr<websocket>> clients;
+    for (const auto& account : cfg.accounts) {
+        auto client = std::make_unique<websocket>(handler);
+        if (backfill_api) {
+            auto acct_api = std::make_unique<api>(*backfill_api);
+            acct_api->uri = account.uri;
+            acct_api->token = account.token;
+            acct_api->scheme = account.scheme;
+            client->client = acct_api.get();
+            client->backfill = backfill;
+            account_apis.push_back(std::move(acct_api));
+        }
+        client->recorder = recorder;
+        client->tls = account.scheme != "http";
+        client->account = account.name;
+        client->channels = account.channels;
+        client->start(account.streaming_uri, account.token);
+        clients.push_back(std::move(client));
+    }
+
+    // Sleep until SIGINT/SIGTERM; wake only when a stats event is due
+    while (!stop_signal.wait(handler.tick_interval())) {
+        handler.tick();
+    }
+    std::string reason = ShutdownSignal::name(ShutdownSignal::received());
+    std::cerr << "[STOP] " << reason << ", closing " << clients.size() << " connection(s)" << std::endl;
+    for (auto& client : clients) client->stop();
+    handler.shutdown(reason);
+    return 0;
+}
+
+// Stream as usual while appending every raw frame to a recording
+int cmd_record(const AppConfig& cfg, const std::vector<std::string>& rest) {
+    auto pos = positional(rest);
+    if (pos.empty()) {
+        std::cerr << "Usage: what record <file> [--gzip]" << std::endl;
+        return 1;
+    }
+    bool gzip = pos[0].ends_with(".gz");
+    for (const auto& a : rest) {
+        if (a == "--gzip") gzip = true;
+    }
+
+    FrameLogWriter recorder;
+    if (!recorder.open(pos[0], gzip)) return 1;
+    std::cerr << "[REC] recording to " << pos[0] << (gzip ? " (gzip)" : "") << std::endl;
+    return cmd_stream(cfg, &recorder);
+}
+
+// Feed a recording through the stream pipeline as if it came off the socket
+// --speed scales the recorded gaps between frames; "max" drops them.
+int cmd_replay(const AppConfig& cfg, const std::vector<std::string>& rest) {
+    auto pos = positional(rest);
+    if (pos.empty()) {
+        std::cerr << "Usage: what replay <file> [--speed 1x|10x|max]" << std::endl;
         return 1;
     }
+    std::string speed_arg = get_flag(rest, "--speed", "1x");
+    double speed = 0; // 0: as fast as possible
+    if (speed_arg != "max") {
+        try { speed = std::stod(speed_arg); } catch (...) {}
+        if (speed <= 0) {
+            std::cerr << "Invalid --speed: " << speed_arg << std::endl;
+            return 1;
+        }
+    }
+
+    FrameLogReader reader;
+    if (!reader.open(pos[0])) return 1;
+
+    EventHandler handler;
+    setup_handler(cfg, handler);
+    handler.start();
+
+    std::string_view frame;
+    uint64_t time_us = 0, first_us = 0, frames = 0;
+    auto started = std::chrono::steady_clock::now();
+    while (reader.next(frame, time_us)) {
+        if (frames == 0) first_us = time_us;
+        if (speed > 0 && time_us > first_us) {
+            auto offset = std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(time_us - first_us) / speed));
+            std::this_thread::sleep_until(started + offset);
+        }
+        handler.handle(frame);
+        handler.tick();
+        frames++;
+    }
+
+    // Let the command workers finish what was queued, including the
+    // events they are running, before stopping them
+    handler.command.drain(std::chrono::milliseconds(-1));
 
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cerr << "[REC] replayed " << frames << " frames in " << secs << "s ("
+              << (secs > 0 ? static_cast<double>(frames) / secs : 0.0) << " frames/s)" << std::endl;
     return 0;
 }
+
+// Response cache for show/user/me ([Cache], default what.cache next to the binary)
+std::shared_ptr<ResponseCache> open_cache(const AppConfig& cfg) {
+    if (!cfg.raw.at_path("Cache.enabled").value_or(true)) return nullptr;
+    std::string path = cfg.raw.at_path("Cache.path").value_or<std::string>("");
+    if (path.empty()) {
+        path = (std::filesystem::path(get_executable_dir()) / "what.cache").string();
+    }
+    auto cache = std::make_shared<ResponseCache>();
+    cache->ttl_s = cfg.raw.at_path("Cache.ttl_s").value_or(300);
+    cache->slots = static_cast<uint32_t>(std::max(cfg.raw.at_path("Cache.slots").value_or(512), 1));
+    cache->slot_size = static_cast<uint32_t>(std::max(cfg.raw.at_path("Cache.slot_kb").value_or(32), 1)) * 1024;
+    if (!cache->open(path)) return nullptr;
+    return cache;
+}
+
+// Unix socket the daemon listens on ([Daemon] socket, default next to the binary)
+std::string daemon_socket_path(const AppConfig& cfg) {
+    std::string path = cfg.raw.at_path("Daemon.socket").value_or<std::string>("");
+    if (path.empty()) {
+        path = (std::filesystem::path(get_executable_dir()) / "what.sock").string();
+    }
+    return path;
+}
+
+#ifndef _WIN32
+// Answer one JSON-RPC request for the daemon
+// "run" executes a CLI subcommand from argv; any other method is a batch
+// command name with the params as its fields.
+json handle_rpc(const api& client, const json& request) {
+    json id = request.value("id", json(nullptr));
+    std::string method = request.value("method", "");
+    json params = request.value("params", json::object());
+
+    if (method == "ping") {
+        return rpc_result(id, "pong");
+    }
+    if (method == "stats") {
+        return rpc_result(id, {{"http", client.connection_stats()},
+                               {"engine", client.engine->get_stats()}});
+    }
+    if (method == "run") {
+        std::vector<std::string> argv;
+        if (params.contains("argv") && params["argv"].is_array()) {
+            for (const auto& a : params["argv"]) {
+                if (a.is_string()) argv.push_back(a.get<std::string>());
+            }
+        }
+        if (argv.empty()) {
+            return rpc_error(id, -32602, "params.argv must be a non-empty string array");
+        }
+        const std::string& cmd = argv[0];
+        if (cmd == "stream" || cmd == "daemon" || cmd == "batch") {
+            return rpc_error(id, -32601, "'" + cmd + "' cannot run through the daemon");
+        }
+        if (pages_output(argv)) {
+            return rpc_error(id, -32601, "--all / --max cannot run through the daemon");
+        }
+
+        std::ostringstream out, err;
+        std::vector<std::string> rest(argv.begin() + 1, argv.end());
+        int code = run_command(client, cmd, rest, out, err);
+        return rpc_result(id, {{"code", code}, {"stdout", out.str()}, {"stderr", err.str()}});
+    }
+
+    if (!params.is_object()) {
+        return rpc_error(id, -32602, "params must be an object");
+    }
+    json cmd = params;
+    cmd["cmd"] = method;
+    std::promise<json> done;
+    dispatch_command(client, cmd, [&done](json result) { done.set_value(std::move(result)); });
+    json result = done.get_future().get();
+    if (result.contains("error")) {
+        const json& e = result["error"];
+        json response = rpc_error(id, 1, e.is_object() ? e.value("message", "api error") : e.dump());
+        response["error"]["data"] = e;
+        return response;
+    }
+    return rpc_result(id, std::move(result));
+}
+
+// Forward a CLI invocation to a running daemon
+// Returns false when no daemon answered, so the caller runs it locally.
+bool forward_to_daemon(const std::string& socket_path, std::vector<std::string> args, int& exit_code) {
+    // The daemon has its own working directory: make file arguments absolute
+    const std::string& cmd = args[0];
+    if (cmd == "upload" || cmd == "post-image" || cmd == "pi") {
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i].starts_with("--")) {
+                i++; // same rule as positional()
+                continue;
+            }
+            args[i] = std::filesystem::absolute(args[i]).string();
+            break;
+        }
+    }
+
+    json response = rpc_call(socket_path, {{"jsonrpc", "2.0"}, {"id", 1}, {"method", "run"},
+                                           {"params", {{"argv", args}}}});
+    if (response.is_null()) return false;
+
+    if (response.contains("error")) {
+        std::cerr << "daemon: " << response["error"].value("message", "") << std::endl;
+        exit_code = 1;
+        return true;
+    }
+    const json& result = response["result"];
+    std::cout << result.value("stdout", "");
+    std::cerr << result.value("stderr", "");
+    exit_code = result.value("code", 0);
+    return true;
+}
+
+// Serve CLI subcommands over a Unix socket, optionally streaming as well
+int cmd_daemon(const AppConfig& cfg, const api& client, const std::vector<std::string>& rest) {
+    bool with_stream = cfg.raw.at_path("Daemon.stream").value_or(true);
+    for (const auto& a : rest) {
+        if (a == "--no-stream") with_stream = false;
+    }
+    std::string socket_path = get_flag(rest, "--socket", daemon_socket_path(cfg));
+
+    RpcServer server([&client](const json& request) { return handle_rpc(client, request); });
+    if (!server.listen(socket_path)) return 1;
+    std::cerr << "[RPC] listening on " << socket_path << std::endl;
+
+    if (!with_stream) {
+        server.serve();
+        return 0;
+    }
+    server.start();
+    return cmd_stream(cfg);
+}
+#endif
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    std::setlocale(LC_ALL, ".UTF8");
+#else
+    std::setlocale(LC_ALL, "");
+#endif
+
+    AppConfig cfg = load_config();
+
+    // Collect args
+    std::vector<std::string> args;
+    bool http_stats = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--http-stats") { http_stats = true; continue; }
+        args.emplace_back(argv[i]);
+    }
+
+    // Default: stream if no args
+    if (args.empty() || args[0] == "stream") {
+        return cmd_stream(cfg);
+    }
+
+    std::string cmd = args[0];
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+
+    if (cmd == "record") {
+        return cmd_record(cfg, rest);
+    }
+    if (cmd == "replay") {
+        return cmd_replay(cfg, rest);
+    }
+
+#ifndef _WIN32
+    // Thin client: hand the command to a running daemon if there is one
+    if (cmd != "daemon" && cmd != "batch" && !http_stats && !pages_output(rest) && !std::getenv("WHAT_NO_DAEMON")) {
+        int code = 0;
+        if (forward_to_daemon(daemon_socket_path(cfg), args, code)) return code;
+    }
+#endif
+
+    api client(cfg.uri, cfg.token, cfg.max_in_flight);
+    client.scheme = cfg.scheme;
+    client.set_rate_limits(cfg.rate_limits);
+    client.cache = open_cache(cfg);
+    int code = 0;
+
+    if (cmd == "daemon") {
+#ifdef _WIN32
+        std::cerr << "what daemon is not supported on Windows" << std::endl;
+        code = 1;
+#else
+        code = cmd_daemon(cfg, client, rest);
+#endif
+    } else if (cmd == "batch") {
+        int concurrency = get_flag_int(rest, "--concurrency", 1);
+        code = run_batch(client, std::cin, std::cout, concurrency);
+    } else {
+        code = run_command(client, cmd, rest, std::cout, std::cerr);
+    }
+
+    if (http_stats) {
+        std::cerr << client.connection_stats().dump() << std::endl;
+        std::cerr << client.engine->get_stats().dump() << std::endl;
+    }
+
+    return code;
+}
@@ -1,12 +1,21 @@
 add_rules("mode.debug", "mode.release")
 add_rules("plugin.compile_commands.autoupdate", {outputdir = ".vscode"})
 
-add_requires("libcurl", "nlohmann_json", "toml++")
+-- Pinned: the event writers use nlohmann_json internals (detail::serializer,
+-- detail::binary_writer) that may change in any release
+add_requires("libcurl", "nlohmann_json 3.11.x", "toml++", "zlib")
 add_requires("openssl", {configs = {tls = true}})
 add_requires("ixwebsocket", {configs = {use_tls = true, zlib = true}})
 
 set_languages("c++23")
 
+option("alloc_stats")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Count heap allocations on the event output path")
+    add_defines("MISSKEY_ALLOC_STATS")
+option_end()
+
 target("what")
     set_kind("binary")
 
@@ -15,10 +24,46 @@ target("what")
     add_files("src/main.cpp")
     add_includedirs("include")
 
-    add_packages("libcurl", "nlohmann_json", "toml++", "openssl", "ixwebsocket")
+    add_packages("libcurl", "nlohmann_json", "toml++", "openssl", "ixwebsocket", "zlib")
+    add_options("alloc_stats")
 
     if is_plat("windows") then
         add_syslinks("ws2_32", "crypt32")
     elseif is_plat("linux") then
         add_syslinks("pthread")
     end
+
+-- Stream pipeline benchmarks: xmake build bench && xmake run bench
+target("bench")
+    set_kind("binary")
+    set_default(false)
+
+    set_encodings("source:utf-8", "target:utf-8")
+
+    add_files("bench/bench.cpp")
+    add_includedirs("include")
+    add_defines("MISSKEY_ALLOC_STATS")
+    set_rundir("$(projectdir)")
+
+    add_packages("nlohmann_json", "zlib")
+
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
+
+-- Local mock Misskey server for offline tests: xmake build mock-server && xmake run mock-server
+target("mock-server")
+    set_kind("binary")
+    set_default(false)
+
+    set_encodings("source:utf-8", "target:utf-8")
+
+    add_files("mock/mock_server.cpp")
+
+    add_packages("nlohmann_json", "ixwebsocket")
+
+    if is_plat("windows") then
+        add_syslinks("ws2_32")
+    elseif is_plat("linux") then
+        add_syslinks("pthread")
+    end